@@ -1,4 +1,6 @@
 INCLUDEPATH *= $$PWD/rubberband/rubberband
+# The Speex resampler that comes with RubberBand, for resampling without stretching
+INCLUDEPATH *= $$PWD/rubberband/src/speex
 
 win32:CONFIG(release, debug|release): LIBS += -L"$$OUT_PWD/../external/release/" -lrubberband
 else:win32:CONFIG(debug, debug|release): LIBS += -L"$$OUT_PWD/../external/debug/" -lrubberband
@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "AudioCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QString>
+
+#include "Settings.h"
+
+// The samples are stored in native endianness, since the cache never leaves the computer
+struct CacheFileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 sample_rate;
+    quint32 channels;
+    quint32 reserved;
+    quint64 frames;
+};
+static_assert(sizeof(CacheFileHeader) == 32, "The samples must be aligned");
+
+static const char CACHE_FILE_MAGIC[8] = {'H', 'I', 'B', 'I', 'P', 'C', 'M', '\0'};
+static constexpr quint32 CACHE_FILE_VERSION = 1;
+static const QString CACHE_FILE_SUFFIX = QStringLiteral(".pcm");
+// How much of each end of a file on disk goes into its key
+static constexpr qint64 KEY_SAMPLE_SIZE = 65536;
+
+bool AudioCache::IsEnabled()
+{
+    return Settings::audio_cache_enabled.Get() && Settings::audio_cache_size.Get() > 0;
+}
+
+QString AudioCache::ComputeKey(const KaraokeContainer::MappedFile& file)
+{
+    if (!IsEnabled())
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Algorithm::Sha1);
+    const auto add_data = [&](qint64 offset, qint64 size) {
+        // addData takes an int size, so feed it in pieces in case the file is huge
+        constexpr qint64 PIECE_SIZE = 1 << 30;
+        for (qint64 end = offset + size; offset < end; offset += PIECE_SIZE)
+        {
+            hash.addData(reinterpret_cast<const char*>(file.GetData() + offset),
+                         static_cast<int>(std::min(PIECE_SIZE, end - offset)));
+        }
+    };
+
+    if (file.GetFilePath().isEmpty() || file.GetSize() <= 2 * KEY_SAMPLE_SIZE)
+    {
+        // Without a path and a modification time to go by, only the whole contents will do
+        add_data(0, file.GetSize());
+    }
+    else
+    {
+        // Together with the size and the modification time, the path and both ends of
+        // the file are enough to tell files apart, without reading all of a file that
+        // is about to be decoded anyway
+        hash.addData(file.GetFilePath().toUtf8());
+        add_data(0, KEY_SAMPLE_SIZE);
+        add_data(file.GetSize() - KEY_SAMPLE_SIZE, KEY_SAMPLE_SIZE);
+    }
+
+    return QStringLiteral("%1-%2-%3").arg(QString::fromLatin1(hash.result().toHex()),
+                                          QString::number(file.GetSize()),
+                                          QString::number(file.GetLastModified().toMSecsSinceEpoch()));
+}
+
+std::unique_ptr<AudioCache::Entry> AudioCache::Load(const QString& key)
+{
+    if (key.isEmpty())
+        return nullptr;
+
+    std::unique_ptr<Entry> entry = std::make_unique<Entry>();
+    entry->m_file.setFileName(GetPath(key));
+    if (!entry->m_file.open(QIODevice::ReadOnly))
+        return nullptr;
+
+    const qint64 file_size = entry->m_file.size();
+    if (file_size < static_cast<qint64>(sizeof(CacheFileHeader)))
+        return nullptr;
+
+    const uchar* data = entry->m_file.map(0, file_size);
+    if (!data)
+        return nullptr;
+
+    CacheFileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    const qint64 expected_size = sizeof(CacheFileHeader) +
+            static_cast<qint64>(header.frames * header.channels * sizeof(float));
+    if (std::memcmp(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CACHE_FILE_VERSION || header.channels == 0 || header.sample_rate == 0 ||
+        file_size != expected_size)
+    {
+        qWarning() << "Ignoring invalid audio cache file" << entry->m_file.fileName();
+        return nullptr;
+    }
+
+    entry->m_format.setCodec("audio/pcm");
+    entry->m_format.setChannelCount(header.channels);
+    entry->m_format.setSampleRate(header.sample_rate);
+    entry->m_format.setSampleSize(32);
+    entry->m_format.setSampleType(QAudioFormat::SampleType::Float);
+    entry->m_frames = header.frames;
+
+    const float* samples = reinterpret_cast<const float*>(data + sizeof(CacheFileHeader));
+    for (quint32 i = 0; i < header.channels; ++i)
+        entry->m_channels.push_back(samples + i * header.frames);
+
+    // The modification time is what the eviction uses to find the least recently used files
+    entry->m_file.setFileTime(QDateTime::currentDateTimeUtc(), QFileDevice::FileTime::FileModificationTime);
+
+    return entry;
+}
+
+void AudioCache::Store(const QString& key, const QAudioFormat& format,
+                       const std::vector<const float*>& channels, qint64 frames)
+{
+    if (key.isEmpty() || !QDir().mkpath(GetDirectory()))
+        return;
+
+    CacheFileHeader header{};
+    std::memcpy(header.magic, CACHE_FILE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_FILE_VERSION;
+    header.sample_rate = format.sampleRate();
+    header.channels = format.channelCount();
+    header.frames = frames;
+
+    // QSaveFile makes sure that a half-written file never ends up in the cache
+    QSaveFile file(GetPath(key));
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    bool success = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    for (const float* channel : channels)
+    {
+        const qint64 size = frames * sizeof(float);
+        success = success && file.write(reinterpret_cast<const char*>(channel), size) == size;
+    }
+
+    if (!success || !file.commit())
+    {
+        qWarning() << "Couldn't write audio cache file" << file.fileName();
+        return;
+    }
+
+    Evict(static_cast<qint64>(Settings::audio_cache_size.Get()) * 1024 * 1024 * 1024);
+}
+
+QString AudioCache::GetDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+           QStringLiteral("/decoded-audio");
+}
+
+QString AudioCache::GetPath(const QString& key)
+{
+    return GetDirectory() + QChar('/') + key + CACHE_FILE_SUFFIX;
+}
+
+void AudioCache::Evict(qint64 max_size)
+{
+    // Sorted by modification time, most recently used first
+    const QFileInfoList files = QDir(GetDirectory()).entryInfoList(
+            {QChar('*') + CACHE_FILE_SUFFIX}, QDir::Filter::Files, QDir::SortFlag::Time);
+
+    qint64 total_size = 0;
+    for (const QFileInfo& file_info : files)
+    {
+        total_size += file_info.size();
+        if (total_size > max_size)
+        {
+            qInfo() << "Evicting audio cache file" << file_info.fileName();
+            QFile::remove(file_info.absoluteFilePath());
+        }
+    }
+}
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QAudioFormat>
+#include <QFile>
+#include <QString>
+
+#include "KaraokeContainer/MappedFile.h"
+
+// An on-disk cache of decoded audio, so that songs which are opened often
+// don't need to be decoded from scratch every time. The cache files contain
+// raw planar float samples, which can be memory-mapped and used directly.
+class AudioCache final
+{
+public:
+    class Entry final
+    {
+    public:
+        QAudioFormat GetPCMFormat() const { return m_format; }
+        qint64 GetFrameCount() const { return m_frames; }
+        // The pointers stay valid for as long as the Entry exists
+        const std::vector<const float*>& GetChannels() const { return m_channels; }
+
+    private:
+        friend class AudioCache;
+
+        QFile m_file;
+        QAudioFormat m_format;
+        qint64 m_frames;
+        std::vector<const float*> m_channels;
+    };
+
+    static bool IsEnabled();
+
+    // Identifies the contents of the file. Only reads a little of the file if it's on disk,
+    // so that it's fast even on a cache miss. Returns an empty string if the cache is disabled
+    static QString ComputeKey(const KaraokeContainer::MappedFile& file);
+
+    // Returns nullptr if there is no usable cache file for the key
+    static std::unique_ptr<Entry> Load(const QString& key);
+
+    // Writes a cache file and evicts the least recently used files if the cache is full
+    static void Store(const QString& key, const QAudioFormat& format,
+                      const std::vector<const float*>& channels, qint64 frames);
+
+private:
+    static QString GetDirectory();
+    static QString GetPath(const QString& key);
+    static void Evict(qint64 max_size);
+};
@@ -0,0 +1,142 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "AudioDecoder.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#define DR_MP3_IMPLEMENTATION
+#include <dr_mp3.h>
+#define DR_FLAC_IMPLEMENTATION
+#include <dr_flac.h>
+
+struct AudioDecoder::State
+{
+    drmp3 mp3;
+    std::vector<drmp3_seek_point> mp3_seek_points;
+    drflac* flac = nullptr;
+};
+
+std::unique_ptr<AudioDecoder> AudioDecoder::Open(const uchar* data, size_t size)
+{
+    std::unique_ptr<State> state = std::make_unique<State>();
+
+    if (drmp3_init_memory(&state->mp3, data, size, nullptr))
+        return std::unique_ptr<AudioDecoder>(new AudioDecoder(Type::MP3, std::move(state), data, size));
+
+    state->flac = drflac_open_memory(data, size);
+    if (state->flac)
+        return std::unique_ptr<AudioDecoder>(new AudioDecoder(Type::FLAC, std::move(state), data, size));
+
+    return nullptr;
+}
+
+std::unique_ptr<AudioDecoder> AudioDecoder::Clone() const
+{
+    std::unique_ptr<AudioDecoder> clone = Open(m_data, m_size);
+
+    // The seek index only depends on the data, so it can be shared
+    if (clone && !m_state->mp3_seek_points.empty())
+    {
+        clone->m_state->mp3_seek_points = m_state->mp3_seek_points;
+        drmp3_bind_seek_table(&clone->m_state->mp3, clone->m_state->mp3_seek_points.size(),
+                              clone->m_state->mp3_seek_points.data());
+    }
+
+    return clone;
+}
+
+AudioDecoder::AudioDecoder(Type type, std::unique_ptr<State> state, const uchar* data, size_t size)
+    : m_type(type), m_state(std::move(state)), m_data(data), m_size(size)
+{
+}
+
+AudioDecoder::~AudioDecoder()
+{
+    if (m_type == Type::MP3)
+        drmp3_uninit(&m_state->mp3);
+    else
+        drflac_close(m_state->flac);
+}
+
+int AudioDecoder::GetChannelCount() const
+{
+    return m_type == Type::MP3 ? m_state->mp3.channels : m_state->flac->channels;
+}
+
+int AudioDecoder::GetSampleRate() const
+{
+    return m_type == Type::MP3 ? m_state->mp3.sampleRate : m_state->flac->sampleRate;
+}
+
+qint64 AudioDecoder::GetFrameCount()
+{
+    if (m_type == Type::FLAC)
+    {
+        // This is 0 if the encoder didn't know the length when writing STREAMINFO,
+        // like when encoding from a pipe. Then the only way to know is to decode it all
+        if (m_state->flac->totalPCMFrameCount > 0)
+            return m_state->flac->totalPCMFrameCount;
+        return Seek(0) ? CountFramesFrom(0) : 0;
+    }
+
+    if (m_state->mp3_seek_points.empty())
+        return drmp3_get_pcm_frame_count(&m_state->mp3);
+
+    // dr_mp3 counted the frames while building the seek index, but doesn't say how many there
+    // were. The index gets us close to the end though, so only the last stretch needs counting
+    const qint64 last_seek_point = m_state->mp3_seek_points.back().pcmFrameIndex;
+    if (!Seek(last_seek_point))
+        return drmp3_get_pcm_frame_count(&m_state->mp3);
+
+    return CountFramesFrom(last_seek_point);
+}
+
+qint64 AudioDecoder::CountFramesFrom(qint64 frame)
+{
+    constexpr qint64 CHUNK_FRAMES = 4096;
+    std::vector<float> chunk(CHUNK_FRAMES * GetChannelCount());
+    qint64 frame_count = frame;
+    qint64 frames_read;
+    while ((frames_read = Read(CHUNK_FRAMES, chunk.data())) > 0)
+        frame_count += frames_read;
+
+    Seek(0);
+    return frame_count;
+}
+
+void AudioDecoder::BuildSeekIndex(quint32 seek_points)
+{
+    // dr_flac already uses the SEEKTABLE block of the file (or a bisection search
+    // if there is none), so building an index is only needed for MP3
+    if (m_type != Type::MP3)
+        return;
+
+    // Each seek point records how many MP3 frames before it must be decoded
+    // and discarded to fill the bit reservoir, so seeking stays sample-exact
+    drmp3_uint32 count = seek_points;
+    m_state->mp3_seek_points.resize(count);
+    if (drmp3_calculate_seek_points(&m_state->mp3, &count, m_state->mp3_seek_points.data()))
+    {
+        m_state->mp3_seek_points.resize(count);
+        drmp3_bind_seek_table(&m_state->mp3, count, m_state->mp3_seek_points.data());
+    }
+    else
+    {
+        m_state->mp3_seek_points.clear();
+    }
+}
+
+bool AudioDecoder::Seek(qint64 frame)
+{
+    return m_type == Type::MP3 ? drmp3_seek_to_pcm_frame(&m_state->mp3, frame) :
+                                 drflac_seek_to_pcm_frame(m_state->flac, frame);
+}
+
+qint64 AudioDecoder::Read(qint64 frames, float* out)
+{
+    return static_cast<qint64>(m_type == Type::MP3 ?
+                               drmp3_read_pcm_frames_f32(&m_state->mp3, frames, out) :
+                               drflac_read_pcm_frames_f32(m_state->flac, frames, out));
+}
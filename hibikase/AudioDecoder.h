@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <QtGlobal>
+
+// Decodes MP3 or FLAC data from memory using dr_mp3/dr_flac.
+// Several decoders can read from the same data at the same time.
+class AudioDecoder final
+{
+public:
+    enum class Type
+    {
+        MP3,
+        FLAC,
+    };
+
+    // Returns nullptr if the data isn't in a supported format
+    static std::unique_ptr<AudioDecoder> Open(const uchar* data, size_t size);
+    // Opens the same data as an existing decoder, starting from the beginning
+    std::unique_ptr<AudioDecoder> Clone() const;
+
+    ~AudioDecoder();
+
+    AudioDecoder(const AudioDecoder&) = delete;
+    AudioDecoder& operator=(const AudioDecoder&) = delete;
+
+    Type GetType() const { return m_type; }
+    int GetChannelCount() const;
+    int GetSampleRate() const;
+    // Returns 0 if the length can't be determined. For MP3, this scans the frame headers of the whole
+    // file, unless BuildSeekIndex has been called, which already did. For FLAC files that don't
+    // store their length, this decodes the whole file. Moves the read position to the start
+    qint64 GetFrameCount();
+
+    // Makes seeking fast and precise, at the cost of scanning the file once.
+    // seek_points is a hint of how many evenly spaced positions to index.
+    // Clones share the index, so it only has to be built once
+    void BuildSeekIndex(quint32 seek_points);
+    bool Seek(qint64 frame);
+    // Reads interleaved float samples. Returns the number of frames read
+    qint64 Read(qint64 frames, float* out);
+
+private:
+    struct State;
+
+    AudioDecoder(Type type, std::unique_ptr<State> state, const uchar* data, size_t size);
+
+    // Counts the frames by decoding from the given frame to the end, then seeks back to the start
+    qint64 CountFramesFrom(qint64 frame);
+
+    Type m_type;
+    std::unique_ptr<State> m_state;
+    const uchar* m_data;
+    size_t m_size;
+};
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "AudioDiagnosticsDialog.h"
+
+#include <utility>
+
+#include <QClipboard>
+#include <QDialogButtonBox>
+#include <QFontDatabase>
+#include <QGuiApplication>
+#include <QPushButton>
+#include <QScrollBar>
+#include <QVBoxLayout>
+
+AudioDiagnosticsDialog::AudioDiagnosticsDialog(std::shared_ptr<AudioStats> stats, QWidget* parent)
+    : QDialog(parent), m_stats(std::move(stats))
+{
+    setWindowTitle(QStringLiteral("Audio Diagnostics"));
+    setWindowFlags(windowFlags() & ~Qt::WindowContextHelpButtonHint);
+
+    m_text_edit = new QPlainTextEdit(this);
+    m_text_edit->setReadOnly(true);
+    m_text_edit->setLineWrapMode(QPlainTextEdit::NoWrap);
+    m_text_edit->setFont(QFontDatabase::systemFont(QFontDatabase::SystemFont::FixedFont));
+
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::StandardButton::Close, this);
+    QPushButton* copy_button = buttons->addButton(QStringLiteral("Copy"), QDialogButtonBox::ButtonRole::ActionRole);
+    QPushButton* reset_button = buttons->addButton(QStringLiteral("Reset"), QDialogButtonBox::ButtonRole::ResetRole);
+    connect(buttons, &QDialogButtonBox::rejected, this, &QDialog::reject);
+    connect(copy_button, &QAbstractButton::clicked, [this] {
+        QGuiApplication::clipboard()->setText(m_stats->Dump());
+    });
+    connect(reset_button, &QAbstractButton::clicked, [this] {
+        m_stats->Reset();
+        Refresh();
+    });
+
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addWidget(m_text_edit);
+    layout->addWidget(buttons);
+
+    connect(&m_timer, &QTimer::timeout, this, &AudioDiagnosticsDialog::Refresh);
+    m_timer.start(500);
+    Refresh();
+}
+
+QSize AudioDiagnosticsDialog::sizeHint() const
+{
+    return QSize(600, 600);
+}
+
+void AudioDiagnosticsDialog::Refresh()
+{
+    // Don't yank the scroll position around while the user is reading
+    const int scroll_position = m_text_edit->verticalScrollBar()->value();
+    m_text_edit->setPlainText(m_stats->Dump());
+    m_text_edit->verticalScrollBar()->setValue(scroll_position);
+}
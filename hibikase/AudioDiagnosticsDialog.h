@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <memory>
+
+#include <QDialog>
+#include <QPlainTextEdit>
+#include <QSize>
+#include <QTimer>
+
+#include "AudioStats.h"
+
+// Shows the AudioStats of the playback, refreshed while the dialog is open
+class AudioDiagnosticsDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit AudioDiagnosticsDialog(std::shared_ptr<AudioStats> stats, QWidget* parent = nullptr);
+
+    QSize sizeHint() const override;
+
+private slots:
+    void Refresh();
+
+private:
+    std::shared_ptr<AudioStats> m_stats;
+
+    QPlainTextEdit* m_text_edit;
+    QTimer m_timer;
+};
@@ -2,109 +2,480 @@
 
 #include "AudioFile.h"
 
-#include <QByteArray>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include <QDebug>
-#include <QDir>
-#include <QIODevice>
 
-#define DR_MP3_IMPLEMENTATION
-#include <dr_mp3.h>
-#define DR_FLAC_IMPLEMENTATION
-#include <dr_flac.h>
+#include "AudioDecoder.h"
+#include "Interleave.h"
+
+// How many frames to decode between each update of the "decoded up to" watermark
+static constexpr qint64 DECODE_CHUNK_FRAMES = 16384;
+// How many frames each thread decodes at a time when decoding in parallel (about 24 seconds)
+static constexpr qint64 DECODE_SEGMENT_FRAMES = 1048576;
+// How many frames to decode between each call to the progress callback (about 6 seconds)
+static constexpr qint64 PROGRESS_INTERVAL_FRAMES = 262144;
+// How much decoded audio to keep in memory in low-memory mode
+static constexpr qint64 WINDOW_SECONDS = 30;
+// How many bytes of an MP3 file to index per seek point (about a second at 128 kbps)
+static constexpr qint64 SEEK_INDEX_BYTES = 16384;
 
-QString AudioFile::Load(QByteArray bytes)
+AudioFile::~AudioFile()
 {
-    int16_t *frames = nullptr;
-    size_t frames_count;
+    {
+        std::lock_guard<std::mutex> lock(m_window_mutex);
+        m_cancel_decoding = true;
+    }
+    m_window_condition.notify_all();
+
+    if (m_decode_thread.joinable())
+        m_decode_thread.join();
+}
+
+QString AudioFile::Load(std::unique_ptr<KaraokeContainer::MappedFile> file,
+                        ProgressCallback progress_callback)
+{
+    m_progress_callback = std::move(progress_callback);
+
+    m_cache_key = m_cache_enabled ? AudioCache::ComputeKey(*file) : QString();
+    if (std::unique_ptr<AudioCache::Entry> entry = AudioCache::Load(m_cache_key))
+    {
+        LoadFromCache(std::move(entry));
+        return QString();
+    }
+
+    // The decoders read straight from the file mapping, without any copying
+    std::unique_ptr<AudioDecoder> decoder = AudioDecoder::Open(file->GetData(),
+                                                               static_cast<size_t>(file->GetSize()));
+    if (!decoder)
+    {
+        qWarning() << "File is not in a supported format (MP3 or FLAC)";
+        return "Unsupported format (not MP3 or FLAC)";
+    }
+
+    qInfo() << (decoder->GetType() == AudioDecoder::Type::MP3 ? "File is MP3" : "File is FLAC");
+
+    // Counting the frames of an MP3 file takes a scan of the whole file, and so does building the
+    // seek index that parallel and windowed decoding need. Building the index first lets the count
+    // come out of the same scan. For FLAC, this does nothing
+    decoder->BuildSeekIndex(static_cast<quint32>(file->GetSize() / SEEK_INDEX_BYTES + 1));
+
+    const qint64 frames_count = decoder->GetFrameCount();
+    if (frames_count <= 0)
+    {
+        qWarning() << "Couldn't determine the length of the audio file";
+        return "Couldn't determine the length of the audio";
+    }
 
-    AudioType type = AudioType::Unknown;
     QAudioFormat format;
-    drmp3 mp3;
-    if (drmp3_init_memory(&mp3, bytes.data(), bytes.length(), nullptr))
+    format.setChannelCount(decoder->GetChannelCount());
+    format.setSampleRate(decoder->GetSampleRate());
+    format.setCodec("audio/pcm");
+    format.setSampleSize(32);
+    format.setSampleType(QAudioFormat::SampleType::Float);
+    // QAudioFormat endianness is default-initialised to the platform one, so
+    // we don't need to set it or convert the endianness ourselves!
+
+    if (m_low_memory_mode)
+        m_window_frames = std::min<qint64>(frames_count, WINDOW_SECONDS * format.sampleRate());
+    const qint64 stored_frames = m_low_memory_mode ? m_window_frames : frames_count;
+
+    m_encoded_file = std::move(file);
+    m_pcm_format = format;
+    m_pcm_data = std::make_unique<float[]>(static_cast<size_t>(stored_frames * format.channelCount()));
+    m_channels.resize(format.channelCount());
+    for (int i = 0; i < format.channelCount(); ++i)
+        m_channels[i] = m_pcm_data.get() + i * stored_frames;
+    m_total_frames = frames_count;
+
+    qInfo() << "PCM data is"
+        << m_pcm_format.sampleSize() << "bit"
+        << m_pcm_format.channelCount() << "channel"
+        << m_pcm_format.sampleRate() << "Hz,"
+        << frames_count << "frames";
+
+    if (m_low_memory_mode)
+    {
+        qInfo() << "Decoding to PCM on demand, keeping" << m_window_frames << "frames in memory";
+
+        // Any position can be decoded on demand, so as far as readers are concerned,
+        // the whole file is available right away
+        m_decoded_frames = frames_count;
+        m_decoding_finished = true;
+        m_decode_thread = std::thread(&AudioFile::DecodeWindowed, this, std::move(decoder));
+        return QString();
+    }
+
+    qInfo() << "Decoding to PCM in the background...";
+
+    m_peaks = std::make_shared<WaveformPeaks>(frames_count);
+    m_decode_thread = std::thread(&AudioFile::Decode, this, std::move(decoder));
+
+    return QString();
+}
+
+void AudioFile::WaitForDecoding()
+{
+    if (m_decode_thread.joinable())
+        m_decode_thread.join();
+}
+
+void AudioFile::LoadFromCache(std::unique_ptr<AudioCache::Entry> entry)
+{
+    qInfo() << "Loaded decoded audio from the cache";
+
+    m_pcm_format = entry->GetPCMFormat();
+    m_channels = entry->GetChannels();
+    m_total_frames = entry->GetFrameCount();
+    m_decoded_frames = entry->GetFrameCount();
+    m_decoding_finished = true;
+    m_cache_entry = std::move(entry);
+
+    // The cache only contains the samples, so the peaks have to be computed again.
+    // That takes a while for a long song, so it happens in the background like decoding
+    m_peaks = std::make_shared<WaveformPeaks>(m_total_frames);
+    m_decode_thread = std::thread(&AudioFile::ComputeCachedPeaks, this);
+}
+
+void AudioFile::ComputeCachedPeaks()
+{
+    const qint64 total_frames = m_total_frames;
+    for (qint64 position = 0; position < total_frames && !m_cancel_decoding;
+         position += PROGRESS_INTERVAL_FRAMES)
+    {
+        const qint64 end = std::min(position + PROGRESS_INTERVAL_FRAMES, total_frames);
+        m_peaks->AddFrames(m_channels, position, end);
+        m_peaks->SetReadyFrames(end, end == total_frames);
+
+        // Lets the waveform get redrawn as it fills in
+        if (m_progress_callback)
+            m_progress_callback(total_frames, total_frames);
+    }
+}
+
+size_t AudioFile::GetFrames(qint64 position, size_t max_frames, const float** channels_out)
+{
+    if (m_window_frames > 0)
+        return GetWindowedFrames(position, max_frames, channels_out);
+
+    const qint64 available = GetDecodedFrames() - position;
+    if (available <= 0)
+        return 0;
+
+    for (size_t i = 0; i < m_channels.size(); ++i)
+        channels_out[i] = m_channels[i] + position;
+
+    return std::min<size_t>(available, max_frames);
+}
+
+size_t AudioFile::GetWindowedFrames(qint64 position, size_t max_frames, const float** channels_out)
+{
+    qint64 available;
+    {
+        std::lock_guard<std::mutex> lock(m_window_mutex);
+        m_read_position = position;
+        available = position >= m_window_start ? m_window_end - position : 0;
+    }
+    // The decoder may now have room to decode more, or may have to seek
+    m_window_condition.notify_one();
+
+    if (available <= 0)
+        return 0;
+
+    // The pointers can't go past the end of the ring buffer
+    const qint64 offset = position % m_window_frames;
+    available = std::min(available, m_window_frames - offset);
+
+    for (size_t i = 0; i < m_channels.size(); ++i)
+        channels_out[i] = m_channels[i] + offset;
+
+    return std::min<size_t>(available, max_frames);
+}
+
+void AudioFile::Decode(std::unique_ptr<AudioDecoder> decoder)
+{
+    const qint64 total_frames = m_total_frames;
+
+    std::vector<float*> channels(m_channels.size());
+    for (size_t i = 0; i < channels.size(); ++i)
+        channels[i] = m_pcm_data.get() + i * total_frames;
+
+    const qint64 segment_count = (total_frames + DECODE_SEGMENT_FRAMES - 1) / DECODE_SEGMENT_FRAMES;
+    int thread_count = m_decode_thread_count > 0 ? m_decode_thread_count :
+                                                   static_cast<int>(std::thread::hardware_concurrency());
+    thread_count = static_cast<int>(std::min<qint64>(thread_count, segment_count));
+
+    qint64 decoded_frames;
+    if (thread_count > 1)
+    {
+        decoded_frames = DecodeInParallel(decoder.get(), channels, thread_count);
+    }
+    else
+    {
+        decoded_frames = DecodeRange(decoder.get(), channels, 0, total_frames,
+                                     [this](qint64 position) { PublishProgress(position); });
+    }
+
+    decoder.reset();
+
+    if (m_cancel_decoding)
+        return;
+
+    const bool complete = decoded_frames == total_frames;
+    if (!complete)
+    {
+        // The length from the headers was wrong, or the file is damaged.
+        // Either way, the frames we did manage to decode are all we have.
+        qWarning() << "Expected" << total_frames << "frames but decoded" << decoded_frames;
+        SetDecodeError(QStringLiteral("Decoding stopped after %1 of %2 seconds, the file may be damaged")
+                       .arg(decoded_frames / m_pcm_format.sampleRate())
+                       .arg(total_frames / m_pcm_format.sampleRate()));
+        m_total_frames = decoded_frames;
+    }
+
+    m_peaks->SetReadyFrames(decoded_frames, true);
+
+    // Unmap the file, we won't need it anymore
+    m_encoded_file.reset();
+    m_decoding_finished.store(true, std::memory_order_release);
+
+    qInfo() << "Finished decoding to PCM using" << std::max(thread_count, 1) << "thread(s)";
+
+    if (m_progress_callback)
+        m_progress_callback(decoded_frames, decoded_frames);
+
+    // A damaged file would otherwise keep playing cut short from the cache, without any error
+    if (complete && GetDecodeError().isEmpty())
+        AudioCache::Store(m_cache_key, m_pcm_format, m_channels, decoded_frames);
+}
+
+void AudioFile::DecodeWindowed(std::unique_ptr<AudioDecoder> decoder)
+{
+    // The seek index was built by Load along with the frame count, so the first window
+    // can be decoded right away
+    std::vector<float*> channels(m_channels.size());
+    for (size_t i = 0; i < channels.size(); ++i)
+        channels[i] = m_pcm_data.get() + i * m_window_frames;
+    std::vector<float> chunk(DECODE_CHUNK_FRAMES * channels.size());
+    std::vector<float*> destinations(channels.size());
+
+    // Keep a quarter of the window behind the read position, so that seeking back a little is instant
+    const qint64 read_ahead_frames = m_window_frames - m_window_frames / 4;
+    qint64 decoder_position = 0;
+    qint64 frames_since_progress = 0;
+
+    while (true)
     {
-        drmp3_uninit(&mp3);
+        qint64 start;
+        qint64 frames;
+        {
+            std::unique_lock<std::mutex> lock(m_window_mutex);
+
+            const auto outside_window = [this] {
+                return m_read_position < m_total_frames &&
+                       (m_read_position < m_window_start || m_read_position > m_window_end);
+            };
+            m_window_condition.wait(lock, [&] {
+                return m_cancel_decoding || outside_window() ||
+                       (m_window_end < m_total_frames && m_window_end < m_read_position + read_ahead_frames);
+            });
+            if (m_cancel_decoding)
+                return;
+
+            // If the reader jumped somewhere else, throw away the window and start over from there
+            if (outside_window())
+            {
+                m_window_start = m_read_position;
+                m_window_end = m_read_position;
+            }
 
-        qInfo() << "File is MP3";
+            start = m_window_end;
+            frames = std::min({DECODE_CHUNK_FRAMES, m_total_frames - start,
+                               m_read_position + read_ahead_frames - start,
+                               m_window_frames - start % m_window_frames});
 
-        type = AudioType::MP3;
+            // The frames that are about to be overwritten are all before the read position
+            m_window_start = std::max(m_window_start, start + frames - m_window_frames);
+        }
 
-        qInfo() << "Decoding MP3 to PCM...";
+        bool failed = false;
+        if (start != decoder_position)
+        {
+            failed = !decoder->Seek(start);
+            decoder_position = failed ? -1 : start;
+        }
 
-        drmp3_config mp3_config = {0, 0};
-        drmp3_uint64 mp3_frames_count;
-        drmp3_int16 *mp3_frames = drmp3_open_memory_and_read_s16(bytes.data(), bytes.length(), &mp3_config, &mp3_frames_count);
-        if (!mp3_frames)
+        const qint64 frames_read = failed ? 0 : decoder->Read(frames, chunk.data());
+        for (size_t i = 0; i < channels.size(); ++i)
+            destinations[i] = channels[i] + start % m_window_frames;
+        if (frames_read > 0)
+        {
+            Interleave::Deinterleave(chunk.data(), frames_read, destinations.data(), channels.size());
+            decoder_position += frames_read;
+        }
+        else
         {
-            qWarning() << "Couldn't decode MP3 file";
-            return "Couldn't decode MP3";
+            // The length is known from Load and readers may already rely on it, so the file
+            // doesn't get any shorter. The chunk that couldn't be decoded is played as silence,
+            // and the next chunk gets another try, from a fresh seek
+            qWarning() << "Couldn't decode frames" << start << "to" << start + frames;
+            SetDecodeError(QStringLiteral("Couldn't decode the audio at %1 seconds, the file may be damaged")
+                           .arg(start / m_pcm_format.sampleRate()));
+            for (size_t i = 0; i < channels.size(); ++i)
+                std::fill(destinations[i], destinations[i] + frames, 0.0f);
+            decoder_position = -1;
+            // Make sure that the error gets reported
+            frames_since_progress = PROGRESS_INTERVAL_FRAMES;
         }
 
-        qInfo() << "Decoded MP3";
+        {
+            std::lock_guard<std::mutex> lock(m_window_mutex);
+            m_window_end = start + (frames_read > 0 ? frames_read : frames);
+        }
 
-        format.setChannelCount(mp3_config.outputChannels);
-        format.setSampleRate(mp3_config.outputSampleRate);
-        frames = mp3_frames;
-        frames_count = mp3_frames_count;
+        // The whole file counts as decoded already, so the callback is only for errors and
+        // such, and doesn't have to be called for every chunk
+        frames_since_progress += frames;
+        if (m_progress_callback && frames_since_progress >= PROGRESS_INTERVAL_FRAMES)
+        {
+            frames_since_progress = 0;
+            m_progress_callback(m_decoded_frames, m_total_frames);
+        }
     }
-    else if (drflac *flac = drflac_open_memory(bytes.data(), bytes.length()))
+}
+
+qint64 AudioFile::DecodeRange(AudioDecoder* decoder, const std::vector<float*>& channels,
+                              qint64 start, qint64 end, const std::function<void(qint64)>& on_progress)
+{
+    // dr_mp3 and dr_flac can only output interleaved samples, so each chunk
+    // passes through this small buffer on its way into the planar PCM store
+    std::vector<float> chunk(DECODE_CHUNK_FRAMES * channels.size());
+    std::vector<float*> destinations(channels.size());
+
+    qint64 position = start;
+    while (position < end && !m_cancel_decoding)
     {
-        drflac_close(flac);
+        const qint64 frames_read = decoder->Read(std::min(DECODE_CHUNK_FRAMES, end - position),
+                                                 chunk.data());
+        if (frames_read <= 0)
+            break;
 
-        qInfo() << "File is FLAC";
+        for (size_t i = 0; i < channels.size(); ++i)
+            destinations[i] = channels[i] + position;
+        Interleave::Deinterleave(chunk.data(), frames_read, destinations.data(), channels.size());
+        m_peaks->AddFrames(m_channels, position, position + frames_read);
+        position += frames_read;
+        on_progress(position);
+    }
+
+    return position;
+}
+
+qint64 AudioFile::DecodeInParallel(AudioDecoder* decoder, const std::vector<float*>& channels,
+                                   int thread_count)
+{
+    const qint64 total_frames = m_total_frames;
+    const qint64 segment_count = (total_frames + DECODE_SEGMENT_FRAMES - 1) / DECODE_SEGMENT_FRAMES;
+    const auto segment_start = [](qint64 segment) { return segment * DECODE_SEGMENT_FRAMES; };
+    const auto segment_end = [total_frames](qint64 segment) {
+        return std::min((segment + 1) * DECODE_SEGMENT_FRAMES, total_frames);
+    };
 
-        type = AudioType::FLAC;
+    // The clones share the seek index from Load, so no decoder has to decode its way
+    // from the start of the file
+    // Segments are handed out in order, so that the start of the file (which is what
+    // the user is most likely to want to play first) becomes available as soon as possible
+    std::atomic<qint64> next_segment{0};
 
-        qInfo() << "Decoding FLAC to PCM...";
+    std::mutex mutex;
+    std::vector<qint64> segment_positions(segment_count);
+    std::vector<bool> segment_done(segment_count, false);
+    for (qint64 i = 0; i < segment_count; ++i)
+        segment_positions[i] = segment_start(i);
+    qint64 first_unfinished_segment = 0;
+    qint64 watermark = 0;
 
-        unsigned int flac_channels, flac_sample_rate;
-        drflac_uint64 flac_frames_count;
-        drflac_int16 *flac_frames = drflac_open_memory_and_read_pcm_frames_s16(bytes.data(), bytes.length(), &flac_channels, &flac_sample_rate, &flac_frames_count);
-        if (!flac_frames)
+    // The watermark is the end of the contiguous decoded region at the start of the file.
+    // Must be called with the mutex held
+    const auto update_watermark = [&] {
+        while (first_unfinished_segment < segment_count &&
+               segment_done[first_unfinished_segment] &&
+               segment_positions[first_unfinished_segment] == segment_end(first_unfinished_segment))
         {
-            qWarning() << "Couldn't decode FLAC file";
-            return "Couldn't decode FLAC";
+            ++first_unfinished_segment;
         }
 
-        qInfo() << "Decoded FLAC";
+        watermark = first_unfinished_segment < segment_count ?
+                    segment_positions[first_unfinished_segment] : total_frames;
+        PublishProgress(watermark);
+    };
 
-        format.setChannelCount(flac_channels);
-        format.setSampleRate(flac_sample_rate);
-        frames = flac_frames;
-        frames_count = flac_frames_count;
-    }
-    else
+    const auto decode_segments = [&](AudioDecoder* segment_decoder) {
+        for (qint64 segment = next_segment++; segment < segment_count && !m_cancel_decoding;
+             segment = next_segment++)
+        {
+            if (segment_decoder->Seek(segment_start(segment)))
+            {
+                DecodeRange(segment_decoder, channels, segment_start(segment), segment_end(segment),
+                            [&, segment](qint64 position) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    segment_positions[segment] = position;
+                    update_watermark();
+                });
+            }
+
+            // If a segment ends early, the watermark stops there, and that becomes the end of the file
+            std::lock_guard<std::mutex> lock(mutex);
+            segment_done[segment] = true;
+            update_watermark();
+        }
+    };
+
+    std::vector<std::unique_ptr<AudioDecoder>> decoders;
+    std::vector<std::thread> threads;
+    for (int i = 1; i < thread_count; ++i)
     {
-        qWarning() << "File is not in a supported format (MP3 or FLAC)";
-        return "Unsupported format (not MP3 or FLAC)";
+        decoders.push_back(decoder->Clone());
+        if (decoders.back())
+            threads.emplace_back(decode_segments, decoders.back().get());
     }
 
-    format.setCodec("audio/pcm");
-    format.setSampleSize(16);
-    format.setSampleType(QAudioFormat::SampleType::SignedInt);
-    // QAudioFormat endianness is default-initialised to the platform one, so
-    // we don't need to set it or convert the endianness ourselves!
+    decode_segments(decoder);
 
-    bytes = QByteArray((const char*)frames, frames_count * format.bytesPerFrame());
+    for (std::thread& thread : threads)
+        thread.join();
 
-    if (type == MP3)
-        drmp3_free(frames);
-    else if (type == FLAC)
-        drflac_free(frames);
-    else
-        assert(0 && "Unhandled case?!");
+    return watermark;
+}
 
-    m_pcm_buffer = std::make_unique<QBuffer>();
-    m_pcm_buffer->setData(bytes);
-    m_pcm_buffer->open(QIODevice::OpenModeFlag::ReadOnly);
+QString AudioFile::GetDecodeError() const
+{
+    std::lock_guard<std::mutex> lock(m_error_mutex);
+    return m_decode_error;
+}
 
-    m_pcm_format = format;
-    m_type = type;
+void AudioFile::SetDecodeError(const QString& error)
+{
+    std::lock_guard<std::mutex> lock(m_error_mutex);
+    if (m_decode_error.isEmpty())
+        m_decode_error = error;
+}
 
-    qInfo() << "PCM data is"
-        << m_pcm_format.sampleSize() << "bit"
-        << m_pcm_format.channelCount() << "channel"
-        << m_pcm_format.sampleRate() << "Hz,"
-        << frames_count << "frames";
+void AudioFile::PublishProgress(qint64 decoded_frames)
+{
+    m_peaks->SetReadyFrames(decoded_frames);
+    m_decoded_frames.store(decoded_frames, std::memory_order_release);
 
-    return QString();
+    if (m_progress_callback && decoded_frames - m_last_reported_frames >= PROGRESS_INTERVAL_FRAMES)
+    {
+        m_last_reported_frames = decoded_frames;
+        m_progress_callback(decoded_frames, m_total_frames);
+    }
 }
@@ -2,37 +2,168 @@
 
 #pragma once
 
-#include <memory>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <QAudioFormat>
-#include <QByteArray>
-#include <QBuffer>
+#include <QString>
+
+#include "AudioCache.h"
+#include "AudioDecoder.h"
+#include "KaraokeContainer/MappedFile.h"
+#include "WaveformPeaks.h"
 
 class AudioFile
 {
 public:
-    QString Load(QByteArray bytes);
+    // Called on the decoding thread whenever a noteworthy amount of audio has been decoded
+    using ProgressCallback = std::function<void(qint64 decoded_frames, qint64 total_frames)>;
+
+    AudioFile() = default;
+    ~AudioFile();
+
+    AudioFile(const AudioFile&) = delete;
+    AudioFile& operator=(const AudioFile&) = delete;
+
+    // Determines the format of the file and starts decoding it on a background thread.
+    // The PCM data becomes readable gradually, see GetDecodedFrames.
+    // In low-memory mode, only a window of audio around the read position is kept
+    // decoded, and the background thread keeps running for as long as the AudioFile exists.
+    QString Load(std::unique_ptr<KaraokeContainer::MappedFile> file,
+                 ProgressCallback progress_callback = {});
+
+    // These must be called before Load. A thread count of 0 means one per CPU core
+    void SetDecodeThreadCount(int thread_count)
+    {
+        m_decode_thread_count = thread_count;
+    }
+    void SetCacheEnabled(bool enabled)
+    {
+        m_cache_enabled = enabled;
+    }
+    void SetLowMemoryMode(bool enabled)
+    {
+        m_low_memory_mode = enabled;
+    }
+    // Whether only a window around the read position is decoded, see GetFrames
+    bool IsWindowed() const
+    {
+        return m_window_frames > 0;
+    }
+
+    // Blocks until the background decoding has finished. Must not be used in low-memory mode
+    void WaitForDecoding();
+
+    // The PCM data is stored as 32-bit float, with each channel in its own array
     QAudioFormat GetPCMFormat() const
     {
         return m_pcm_format;
     }
-    QBuffer *GetPCMBuffer() const
+    // Sets channels_out[i] to point to the samples of channel i starting at the given frame,
+    // and returns how many frames (at most max_frames) can be read through those pointers.
+    // The pointers stay valid for as long as the AudioFile exists, or in low-memory mode,
+    // until the next call. Only one thread may call this. In low-memory mode, this also
+    // tells the decoder where to decode, and may return 0 until it has caught up.
+    size_t GetFrames(qint64 position, size_t max_frames, const float** channels_out);
+    // The whole PCM data of each channel. Only usable once decoding has finished, and not in low-memory mode
+    const std::vector<const float*>& GetChannels() const
+    {
+        return m_channels;
+    }
+    // Filled in gradually while decoding, see WaveformPeaks::GetReadyFrames.
+    // nullptr in low-memory mode, since the whole file is never decoded
+    std::shared_ptr<const WaveformPeaks> GetWaveformPeaks() const
+    {
+        return m_peaks;
+    }
+    // The "decoded up to" watermark. Never decreases. In low-memory mode,
+    // every position can be decoded on demand, so this is the whole file
+    qint64 GetDecodedFrames() const
+    {
+        return m_decoded_frames.load(std::memory_order_acquire);
+    }
+    qint64 GetFrameCount() const
+    {
+        return m_total_frames.load(std::memory_order_acquire);
+    }
+    bool IsDecodingFinished() const
     {
-        return m_pcm_buffer.get();
+        return m_decoding_finished.load(std::memory_order_acquire);
     }
+    // Empty unless decoding ran into an error after Load, in which case
+    // only the audio before the error can be played
+    QString GetDecodeError() const;
     std::chrono::microseconds GetDuration() const
     {
-        if (!m_pcm_buffer)
-            return std::chrono::milliseconds::zero();
-        return std::chrono::microseconds(m_pcm_format.durationForBytes(m_pcm_buffer->size()));
+        return DurationForFrames(GetFrameCount());
+    }
+    std::chrono::microseconds GetDecodedDuration() const
+    {
+        return DurationForFrames(GetDecodedFrames());
+    }
+    std::chrono::microseconds DurationForFrames(qint64 frames) const
+    {
+        return std::chrono::microseconds(frames * 1000000 / m_pcm_format.sampleRate());
+    }
+    qint64 FramesForDuration(std::chrono::microseconds duration) const
+    {
+        return duration.count() * m_pcm_format.sampleRate() / 1000000;
     }
+
 private:
-    enum AudioType {
-        Unknown = 0,
-        MP3,
-        FLAC,
-    } m_type = AudioType::Unknown;
+    void Decode(std::unique_ptr<AudioDecoder> decoder);
+    qint64 DecodeRange(AudioDecoder* decoder, const std::vector<float*>& channels,
+                       qint64 start, qint64 end, const std::function<void(qint64)>& on_progress);
+    qint64 DecodeInParallel(AudioDecoder* decoder, const std::vector<float*>& channels,
+                            int thread_count);
+    void DecodeWindowed(std::unique_ptr<AudioDecoder> decoder);
+    size_t GetWindowedFrames(qint64 position, size_t max_frames, const float** channels_out);
+    void LoadFromCache(std::unique_ptr<AudioCache::Entry> entry);
+    void ComputeCachedPeaks();
+    void PublishProgress(qint64 decoded_frames);
+    void SetDecodeError(const QString& error);
+
+    int m_decode_thread_count = 0;
+    bool m_cache_enabled = true;
+    bool m_low_memory_mode = false;
+
+    std::unique_ptr<KaraokeContainer::MappedFile> m_encoded_file;
     QAudioFormat m_pcm_format;
-    std::unique_ptr<QBuffer> m_pcm_buffer = nullptr;
+    // All channels share one allocation, one channel after the other
+    std::unique_ptr<float[]> m_pcm_data;
+    std::vector<const float*> m_channels;
+
+    // If the file was found in the cache, m_channels points into this instead of m_pcm_data
+    std::unique_ptr<AudioCache::Entry> m_cache_entry;
+    QString m_cache_key;
+
+    std::shared_ptr<WaveformPeaks> m_peaks;
+
+    // In low-memory mode, m_pcm_data is a ring buffer holding the frames
+    // [m_window_start, m_window_end), with frame n stored at n % m_window_frames.
+    // The decoder never overwrites frames at or after m_read_position.
+    qint64 m_window_frames = 0;
+    std::mutex m_window_mutex;
+    std::condition_variable m_window_condition;
+    qint64 m_window_start = 0;
+    qint64 m_window_end = 0;
+    qint64 m_read_position = 0;
+
+    mutable std::mutex m_error_mutex;
+    QString m_decode_error;
+
+    ProgressCallback m_progress_callback;
+    qint64 m_last_reported_frames = 0;
+
+    std::thread m_decode_thread;
+    std::atomic<bool> m_cancel_decoding{false};
+    std::atomic<bool> m_decoding_finished{false};
+    std::atomic<qint64> m_decoded_frames{0};
+    std::atomic<qint64> m_total_frames{0};
 };
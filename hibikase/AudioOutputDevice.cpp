@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "AudioOutputDevice.h"
+
+#include <utility>
+
+AudioOutputDevice::AudioOutputDevice(ReadFunction read_function, QObject* parent)
+    : QIODevice(parent), m_read_function(std::move(read_function))
+{
+}
+
+bool AudioOutputDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 AudioOutputDevice::readData(char* data, qint64 max_size)
+{
+    return m_read_function(data, max_size);
+}
+
+qint64 AudioOutputDevice::writeData(const char*, qint64)
+{
+    return -1;
+}
@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <functional>
+
+#include <QIODevice>
+#include <QObject>
+
+// A read-only QIODevice for QAudioOutput to pull samples from. Each read is
+// forwarded to a function that produces the samples on demand, so samples are
+// generated exactly when the audio output needs them, instead of being pushed
+// in ahead of time from a timer.
+class AudioOutputDevice final : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    // Writes up to max_size bytes to data and returns how many bytes were written
+    using ReadFunction = std::function<qint64(char* data, qint64 max_size)>;
+
+    explicit AudioOutputDevice(ReadFunction read_function, QObject* parent = nullptr);
+
+    bool isSequential() const override;
+
+protected:
+    qint64 readData(char* data, qint64 max_size) override;
+    qint64 writeData(const char* data, qint64 max_size) override;
+
+private:
+    ReadFunction m_read_function;
+};
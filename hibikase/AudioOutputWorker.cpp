@@ -3,254 +3,451 @@
 #include "AudioOutputWorker.h"
 
 #include <algorithm>
-#include <limits>
-#include <type_traits>
 #include <utility>
 
-#include <QByteArray>
 #include <QDebug>
 
 #include "Settings.h"
 
-AudioOutputWorker::AudioOutputWorker(std::unique_ptr<QIODevice> io_device, QObject* parent)
-    : QObject(parent), m_io_device(std::move(io_device))
+// How much audio the audio output buffers
+static constexpr std::chrono::microseconds OUTPUT_BUFFER_DURATION(50000);
+// While scrubbing, the grains for a new position have to get through the buffer
+// before they're heard, so it's kept small at the risk of the odd dropout
+static constexpr std::chrono::microseconds SCRUB_BUFFER_DURATION(10000);
+// Only used for updating the current time
+static constexpr std::chrono::milliseconds NOTIFY_INTERVAL(10);
+
+// How many prerendered speeds to keep in memory
+static constexpr size_t MAX_PRERENDERED = 3;
+// How much memory the prerendered speeds may take up together. A speed that needs more
+// than this on its own (a long file at a very slow speed) only gets stretched in real time
+static constexpr qint64 MAX_PRERENDERED_BYTES = 1024LL * 1024 * 1024;
+// How long the speed has to stay the same before it gets prerendered,
+// so that moving the speed slider doesn't start a render for every step
+static constexpr std::chrono::milliseconds PRERENDER_DELAY(500);
+
+AudioOutputWorker::AudioOutputWorker(std::unique_ptr<KaraokeContainer::MappedFile> file,
+                                     std::shared_ptr<PlaybackClock> clock, std::shared_ptr<AudioStats> stats,
+                                     QObject* parent)
+    : QObject(parent), m_file(std::move(file)), m_clock(std::move(clock)), m_stats(std::move(stats))
 {
     qRegisterMetaType<std::chrono::microseconds>();
     qRegisterMetaType<PlaybackState>("PlaybackState");
+    qRegisterMetaType<std::shared_ptr<const WaveformPeaks>>();
 }
 
 void AudioOutputWorker::Initialize()
 {
-    QByteArray audio_bytes = m_io_device->readAll();
-    m_io_device->close();
-    m_io_device.reset();
+    m_prerender_timer = new QTimer(this);
+    m_prerender_timer->setSingleShot(true);
+    m_prerender_timer->setInterval(PRERENDER_DELAY);
+    connect(m_prerender_timer, &QTimer::timeout, this, &AudioOutputWorker::StartPrerendering);
 
     m_audio_file = std::make_unique<AudioFile>();
-    QString result = m_audio_file->Load(audio_bytes);
+    m_audio_file->SetLowMemoryMode(Settings::audio_low_memory.Get());
+    QString result = m_audio_file->Load(std::move(m_file), [this](qint64, qint64) {
+        // Called on the decoding thread, so hop over to our own thread
+        QMetaObject::invokeMethod(this, "OnDecodeProgress", Qt::ConnectionType::QueuedConnection);
+    });
     if (!result.isEmpty())
     {
         emit AudioOutputWorker::LoadFinished(result);
         return;
     }
 
-    QAudioFormat float_format(m_audio_file->GetPCMFormat());
-    float_format.setSampleSize(32);
-    float_format.setSampleType(QAudioFormat::SampleType::Float);
+    // Resampling to the rate of the sound device is done by the stretcher in the same pass as the
+    // stretching, or at 100% speed, by a resampler in the renderer
+    const QAudioFormat format = AudioSink::GetNativeFormat(m_audio_file->GetPCMFormat());
+    if (format.sampleRate() != m_audio_file->GetPCMFormat().sampleRate())
+    {
+        qInfo() << "Resampling audio from" << m_audio_file->GetPCMFormat().sampleRate() << "Hz to"
+                << format.sampleRate() << "Hz";
+    }
 
-    m_audio_output = std::make_unique<QAudioOutput>(float_format, this);
-    m_audio_output->setNotifyInterval(10);
+    // Samples are produced on demand, so the buffer doesn't have to cover for timer jitter
+    m_audio_output = AudioSink::Create(format, OUTPUT_BUFFER_DURATION, NOTIFY_INTERVAL, this);
 
-    m_stretcher_float_buffers.resize(float_format.channelCount());
-    m_stretcher_float_buffers_pointers.resize(float_format.channelCount());
+    m_output_device = std::make_unique<AudioOutputDevice>([this](char* data, qint64 max_size) {
+        return ReadOutput(data, max_size);
+    });
+    m_output_device->open(QIODevice::ReadOnly);
 
-    m_stretcher = std::make_unique<RubberBand::RubberBandStretcher>(
-                float_format.sampleRate(), float_format.channelCount(),
-                RubberBand::RubberBandStretcher::Option::OptionProcessRealTime);
+    m_renderer = std::make_unique<AudioRenderer>(
+            m_audio_file.get(), format.sampleRate(),
+            static_cast<size_t>(format.framesForDuration(Settings::audio_buffer_size.Get() * 1000)),
+            m_stats.get());
 
     // On macOS, the AudioOutputWorker could get stuck in a deadlock with a
     // stack-trace like:
     // - AudioOutputWorker::Play()
     //   - <Qt stackframes>
     //     - AudioOutputWorker::OnStateChanged()
-    //       - AudioOutputWorker::PushSamplesToOutput()
+    //       - AudioOutputWorker::Stop()
     //         - <Qt stackframes>
     //           - QBasicMutex::lockInternal()
     // Apparently, the recursive handling of events causes Qt to attempt to lock
     // a mutex it already holds a lock on, hanging the thread.
     // Making the connection be queued fixes this.
-    connect(m_audio_output.get(), &QAudioOutput::stateChanged, this,
+    connect(m_audio_output.get(), &AudioSink::StateChanged, this,
             &AudioOutputWorker::OnStateChanged, Qt::ConnectionType::QueuedConnection);
-    connect(m_audio_output.get(), &QAudioOutput::notify, this,
+    connect(m_audio_output.get(), &AudioSink::Notify, this,
             &AudioOutputWorker::OnNotify, Qt::ConnectionType::QueuedConnection);
 
+    emit WaveformAvailable(m_audio_file->GetWaveformPeaks());
     emit LoadFinished(QString());
 }
 
 void AudioOutputWorker::Play()
 {
-    if (m_audio_output->state() == QAudio::State::IdleState)
-    {
-        // "idle state" means the audio output ran out of samples to play.
-        // In general this will immediately be resolved by pushing more samples
-        // in the state-change callback, but there can be edge cases where this
-        // does not happen. Pushing more samples should make the "Play" button
-        // useful here.
-        PushSamplesToOutput();
-    }
-    else if (m_audio_output->state() != QAudio::State::StoppedState)
+    if (m_audio_output->GetState() != QAudio::State::StoppedState)
     {
-        m_audio_output->resume();
+        // In IdleState, the audio output is still pulling, waiting for the decoder to catch up
+        m_audio_output->Resume();
     }
     else
     {
-        m_start_offset = 0;
-        m_current_offset = 0;
-        m_last_seek_offset = 0;
-        m_last_speed_change_offset = 0;
-
-        m_output_buffer = m_audio_output->start();
-        PushSamplesToOutput();
+        m_stats->Reset();
+        ConfigureStretcher();
+        m_renderer->Start();
+        m_audio_output->Start(m_output_device.get());
     }
 }
 
 void AudioOutputWorker::Seek(std::chrono::microseconds to)
 {
-    const qint32 offset = m_audio_file->GetPCMFormat().bytesForDuration(to.count());
-    m_start_offset += static_cast<qint32>((offset - m_current_offset) *
-                                          m_stretcher->getTimeRatio());
-    m_current_offset = offset;
-    m_last_seek_offset = offset;
+    // We can only seek to the part of the file that has been decoded so far
+    const qint64 frame = std::min(m_audio_file->FramesForDuration(to), m_audio_file->GetDecodedFrames());
+    m_renderer->Seek(frame);
+    // Whatever the output has buffered would delay the new position by up to OUTPUT_BUFFER_DURATION
+    m_audio_output->Flush();
+    PublishClock(GetOutputFrame(), frame);
+    CheckLoop();
 
     // Make sure to emit at least one TimeUpdated after seeking. OnNotify won't do it when suspended
-    emit TimeUpdated(DurationForBytes(offset), m_audio_file->GetDuration());
+    emit TimeUpdated(DurationForFrames(frame), m_audio_file->GetDuration());
 }
 
-void AudioOutputWorker::Pause()
+void AudioOutputWorker::Scrub(std::chrono::microseconds to)
 {
-    m_audio_output->suspend();
-}
+    const qint64 frame = std::min(m_audio_file->FramesForDuration(to), m_audio_file->GetDecodedFrames());
 
-void AudioOutputWorker::Stop()
-{
-    m_audio_output->stop();
-    m_audio_output->reset();
-    m_output_buffer = nullptr;
-    m_stretcher->reset();
+    if (m_scrubbing)
+    {
+        m_renderer->Scrub(frame);
+        return;
+    }
+
+    m_scrubbing = true;
+    m_state_before_scrub = m_audio_output->GetState();
+    if (m_state_before_scrub == QAudio::State::StoppedState)
+    {
+        m_stats->Reset();
+        ConfigureStretcher();
+        m_renderer->Start();
+    }
+
+    m_renderer->Scrub(frame);
+    // Also throws away what the output has buffered for normal playback, so that the first grain is heard
+    // right away. After that, the small buffer and the short grains keep up with the mouse
+    m_audio_output->SetBufferDuration(SCRUB_BUFFER_DURATION);
+
+    if (m_state_before_scrub == QAudio::State::StoppedState)
+        m_audio_output->Start(m_output_device.get());
+    else
+        m_audio_output->Resume();
 }
 
-void AudioOutputWorker::SetSpeed(double slowdown)
+void AudioOutputWorker::EndScrub(std::chrono::microseconds to)
 {
-    const qint32 duration = m_current_offset - m_last_speed_change_offset;
-    m_start_offset -= static_cast<qint32>(duration * (m_stretcher->getTimeRatio() - 1));
-    m_last_speed_change_offset = m_current_offset;
+    if (!m_scrubbing)
+    {
+        Seek(to);
+        return;
+    }
+
+    m_scrubbing = false;
+    const qint64 frame = std::min(m_audio_file->FramesForDuration(to), m_audio_file->GetDecodedFrames());
+    m_renderer->StopScrubbing(frame);
+    // Also throws away the last grains
+    m_audio_output->SetBufferDuration(OUTPUT_BUFFER_DURATION);
+    CheckLoop();
+
+    switch (m_state_before_scrub)
+    {
+    case QAudio::State::StoppedState:
+        // Stopping goes back to the beginning anyway
+        Stop();
+        return;
+    case QAudio::State::SuspendedState:
+    case QAudio::State::InterruptedState:
+        Pause();
+        break;
+    default:
+        break;
+    }
 
-    m_stretcher->setTimeRatio(slowdown);
+    PublishClock(GetOutputFrame(), frame);
+    emit TimeUpdated(DurationForFrames(frame), m_audio_file->GetDuration());
 }
 
-template <typename T>
-static void SeparateChannels(const T* in, std::vector<std::vector<float>>* out)
+void AudioOutputWorker::SetLoop(std::chrono::microseconds start, std::chrono::microseconds end)
 {
-    static_assert(std::is_integral<T>() && std::is_signed<T>(), "Incompatible type");
-    const float scale = 1.0f / (std::numeric_limits<T>::max() + 1.0f);
+    const qint64 start_frame = std::min(m_audio_file->FramesForDuration(start), m_audio_file->GetDecodedFrames());
+    const qint64 end_frame = std::min(m_audio_file->FramesForDuration(end), m_audio_file->GetFrameCount());
+    if (end_frame <= start_frame)
+        return;
 
-    for (size_t i = 0; i < out->size(); ++i)
+    if (m_audio_output->GetState() == QAudio::State::StoppedState)
     {
-        const T* ptr = in + i;
-        for (size_t j = 0; j < (*out)[i].size(); ++j)
-        {
-            (*out)[i][j] = *ptr * scale;
-            ptr += out->size();
-        }
+        // Play starts from the beginning of the file, so the loop has to be set afterwards
+        Play();
+    }
+    else if (m_audio_output->GetState() == QAudio::State::SuspendedState)
+    {
+        m_audio_output->Resume();
     }
+
+    m_renderer->SetLoop(start_frame, end_frame);
+    m_looping = true;
+    m_audio_output->Flush();
+    PublishClock(GetOutputFrame(), start_frame);
+    emit TimeUpdated(DurationForFrames(start_frame), m_audio_file->GetDuration());
+}
+
+void AudioOutputWorker::ClearLoop()
+{
+    m_renderer->ClearLoop();
+    m_looping = false;
 }
 
-static void InterleaveChannels(const std::vector<std::vector<float>>& in, float* out)
+void AudioOutputWorker::CheckLoop()
 {
-    for (size_t i = 0; i < in.size(); ++i)
+    if (m_looping && !m_renderer->HasLoop())
     {
-        float* ptr = out + i;
-        for (size_t j = 0; j < in[i].size(); ++j)
-        {
-            *ptr = in[i][j];
-            ptr += in.size();
-        }
+        m_looping = false;
+        emit LoopCleared();
     }
 }
 
-bool AudioOutputWorker::PushSamplesToStretcher()
+void AudioOutputWorker::Pause()
+{
+    m_audio_output->Suspend();
+}
+
+void AudioOutputWorker::Stop()
+{
+    m_audio_output->Stop();
+
+    qInfo() << "Audio buffer: lowest fill level" << m_stats->min_fill_frames.load() << "of"
+            << m_stats->capacity_frames.load() << "frames," << m_stats->underruns.load() << "underruns";
+    m_automatic_threading = m_renderer->ChooseStretcherThreading();
+    m_renderer->Stop();
+    PublishClock(0, 0);
+    CheckLoop();
+}
+
+void AudioOutputWorker::SetSpeed(double slowdown)
+{
+    m_time_ratio = slowdown;
+    // Until the prerendered audio is ready, the real-time stretcher is used
+    std::shared_ptr<StretchedAudio> prerendered = FindPrerendered();
+    m_renderer->SetTimeRatio(slowdown, prerendered);
+    if (!prerendered)
+        m_prerender_timer->start();
+}
+
+void AudioOutputWorker::ConfigureStretcher()
 {
-    const QByteArray& audio_buffer = m_audio_file->GetPCMBuffer()->data();
-    if (m_current_offset >= audio_buffer.size())
-        return false;
-
-    const size_t bytes_per_frame = m_audio_file->GetPCMFormat().bytesPerFrame();
-    const size_t frames = std::min<size_t>((audio_buffer.size() - m_current_offset) / bytes_per_frame,
-                                           m_stretcher->getSamplesRequired());
-    for (size_t i = 0; i < m_stretcher_float_buffers.size(); ++i)
+    // In the same order as the choices of the setting
+    RealTimeStretcher::Threading threading;
+    switch (Settings::stretcher_threads.Get())
     {
-        m_stretcher_float_buffers[i].resize(frames);
-        m_stretcher_float_buffers_pointers[i] = m_stretcher_float_buffers[i].data();
+    case 1:
+        threading = RealTimeStretcher::Threading::Single;
+        break;
+    case 2:
+        threading = RealTimeStretcher::Threading::PerChannel;
+        break;
+    default:
+        threading = m_automatic_threading;
+        break;
     }
 
-    const size_t bytes_per_sample = bytes_per_frame / m_stretcher_float_buffers.size();
-    Q_ASSERT(bytes_per_sample == 2 &&
-             m_audio_file->GetPCMFormat().sampleType() == QAudioFormat::SampleType::SignedInt);
-    SeparateChannels(reinterpret_cast<const int16_t*>(audio_buffer.data() + m_current_offset),
-                     &m_stretcher_float_buffers);
+    m_renderer->SetStretcherOptions(threading, RealTimeStretcher::GetQualityOptionsFromSettings());
+}
+
+qint64 AudioOutputWorker::ReadOutput(char* data, qint64 max_size)
+{
+    // The audio output only ever copies frames that are ready, it never waits for them
+    const qint64 bytes_per_frame = m_audio_output->GetFormat().bytesPerFrame();
+    const size_t frames = m_renderer->Read(reinterpret_cast<float*>(data),
+                                           static_cast<size_t>(max_size / bytes_per_frame));
+    return static_cast<qint64>(frames) * bytes_per_frame;
+}
+
+bool AudioOutputWorker::IsAtEnd() const
+{
+    return m_renderer->IsFinished();
+}
+
+qint64 AudioOutputWorker::GetOutputFrame() const
+{
+    const std::chrono::microseconds setting_latency = std::chrono::milliseconds(
+            Settings::audio_latency.Get() - Settings::video_latency.Get());
+
+    return m_audio_output->GetFormat().framesForDuration(
+            (m_audio_output->GetProcessedDuration() - setting_latency).count());
+}
 
-    m_current_offset += frames * bytes_per_frame;
-    const bool final = m_current_offset == audio_buffer.size();
-    m_stretcher->process(m_stretcher_float_buffers_pointers.data(), frames, final);
+void AudioOutputWorker::PublishClock(qint64 output_frame, qint64 input_frame)
+{
+    // In IdleState, the output is waiting for the decoder, so the position isn't moving
+    const bool running = m_audio_output->GetState() == QAudio::State::ActiveState;
+    m_clock->Publish(output_frame, input_frame, m_time_ratio, m_audio_file->GetPCMFormat().sampleRate(), running);
+}
 
-    return true;
+std::shared_ptr<StretchedAudio> AudioOutputWorker::FindPrerendered()
+{
+    const RubberBand::RubberBandStretcher::Options quality_options =
+            RealTimeStretcher::GetQualityOptionsFromSettings();
+    auto it = std::find_if(m_prerendered.begin(), m_prerendered.end(), [&](const auto& prerendered) {
+        return prerendered->GetTimeRatio() == m_time_ratio && prerendered->GetQualityOptions() == quality_options;
+    });
+    if (it == m_prerendered.end())
+        return nullptr;
+
+    std::rotate(it, it + 1, m_prerendered.end());
+    return m_prerendered.back()->IsFinished() ? m_prerendered.back() : nullptr;
 }
 
-void AudioOutputWorker::PushSamplesToOutput()
+void AudioOutputWorker::StartPrerendering()
 {
-    // Handle race condition where there are queued events that trigger pushing
-    // samples, but the audio has already been stopped.
-    if (!m_output_buffer)
+    if (!CanPrerender())
         return;
 
-    do
+    const RubberBand::RubberBandStretcher::Options quality_options =
+            RealTimeStretcher::GetQualityOptionsFromSettings();
+    const bool exists = std::any_of(m_prerendered.begin(), m_prerendered.end(), [&](const auto& prerendered) {
+        return prerendered->GetTimeRatio() == m_time_ratio && prerendered->GetQualityOptions() == quality_options;
+    });
+    if (exists)
+        return;
+
+    const int output_sample_rate = m_audio_output->GetFormat().sampleRate();
+    const qint64 bytes = StretchedAudio::GetByteCount(*m_audio_file, m_time_ratio, output_sample_rate);
+    if (bytes > MAX_PRERENDERED_BYTES)
     {
-        const size_t bytes_per_frame = m_audio_output->format().bytesPerFrame();
-        size_t frames = std::min<size_t>(m_audio_output->bytesFree() / bytes_per_frame,
-                                         m_stretcher->available());
-        if (frames == 0)
-            continue;
+        qInfo() << "Not rendering audio at time ratio" << m_time_ratio << "ahead of time, since it would take"
+                << bytes / (1024 * 1024) << "MiB";
+        return;
+    }
 
-        for (size_t i = 0; i < m_stretcher_float_buffers.size(); ++i)
+    // Only the current speed is worth the CPU time, so renders for other speeds are stopped
+    for (auto it = m_prerendered.begin(); it != m_prerendered.end();)
+    {
+        if (!(*it)->IsFinished())
+        {
+            CancelPrerendered(std::move(*it));
+            it = m_prerendered.erase(it);
+        }
+        else
         {
-            m_stretcher_float_buffers[i].resize(frames);
-            m_stretcher_float_buffers_pointers[i] = m_stretcher_float_buffers[i].data();
+            ++it;
         }
+    }
 
-        frames = m_stretcher->retrieve(m_stretcher_float_buffers_pointers.data(), frames);
-        if (frames == 0)
-            continue;
+    // Make room by throwing away the least recently used speeds
+    qint64 total_bytes = bytes;
+    for (const std::shared_ptr<StretchedAudio>& prerendered : m_prerendered)
+        total_bytes += prerendered->GetByteCount();
+    while (!m_prerendered.empty() && (m_prerendered.size() >= MAX_PRERENDERED || total_bytes > MAX_PRERENDERED_BYTES))
+    {
+        total_bytes -= m_prerendered.front()->GetByteCount();
+        m_prerendered.erase(m_prerendered.begin());
+    }
 
-        m_stretcher_buffer.resize(frames * bytes_per_frame);
-        InterleaveChannels(m_stretcher_float_buffers, reinterpret_cast<float*>(m_stretcher_buffer.data()));
+    m_prerendered.push_back(std::make_shared<StretchedAudio>(
+            *m_audio_file, m_time_ratio, output_sample_rate, quality_options, [this] {
+        // Called on a rendering thread, so hop over to our own thread
+        QMetaObject::invokeMethod(this, "OnPrerenderFinished", Qt::ConnectionType::QueuedConnection);
+    }));
+}
 
-        m_output_buffer->write(m_stretcher_buffer.data(), m_stretcher_buffer.size());
-    } while (m_audio_output->bytesFree() && PushSamplesToStretcher());
+bool AudioOutputWorker::CanPrerender() const
+{
+    return m_time_ratio != 1.0 && Settings::audio_prerender.Get() &&
+           m_audio_file->IsDecodingFinished() && m_audio_file->GetWaveformPeaks();  // Not in low-memory mode
+}
 
-    if (m_current_offset == m_audio_file->GetPCMBuffer()->size())
-        Stop();
+void AudioOutputWorker::CancelPrerendered(std::shared_ptr<StretchedAudio> prerendered)
+{
+    // Destroying it now would wait for its threads to notice
+    prerendered->Cancel();
+    m_cancelled_prerendered.push_back(std::move(prerendered));
+}
+
+std::chrono::microseconds AudioOutputWorker::DurationForFrames(qint64 frames)
+{
+    return m_audio_file->DurationForFrames(frames);
 }
 
-std::chrono::microseconds AudioOutputWorker::DurationForBytes(qint32 bytes)
+void AudioOutputWorker::OnDecodeProgress()
 {
-    return std::chrono::microseconds((bytes < 0 ? -1 : 1) *
-                                     m_audio_file->GetPCMFormat().durationForBytes(std::abs(bytes)));
+    emit LoadProgress(m_audio_file->GetDecodedDuration(), m_audio_file->GetDuration());
+
+    if (!m_decode_error_reported)
+    {
+        const QString error = m_audio_file->GetDecodeError();
+        if (!error.isEmpty())
+        {
+            m_decode_error_reported = true;
+            emit DecodeFailed(error);
+        }
+    }
+
+    // If a speed was picked while decoding, it can be prerendered now
+    if (m_audio_file->IsDecodingFinished())
+        StartPrerendering();
+}
+
+void AudioOutputWorker::OnPrerenderFinished()
+{
+    // Once a cancelled render is no longer running, its threads are on their way out,
+    // so destroying it doesn't hold this thread up
+    m_cancelled_prerendered.erase(std::remove_if(m_cancelled_prerendered.begin(), m_cancelled_prerendered.end(),
+                                                 [](const auto& prerendered) { return !prerendered->IsRunning(); }),
+                                  m_cancelled_prerendered.end());
+
+    if (std::shared_ptr<StretchedAudio> prerendered = FindPrerendered())
+        m_renderer->OfferPrerendered(std::move(prerendered));
 }
 
 void AudioOutputWorker::OnNotify()
 {
-    const qint64 stretcher_latency_us = m_audio_output->format().durationForFrames(
-            static_cast<qint32>(m_stretcher->getLatency()));
-    const std::chrono::milliseconds setting_latency(
-            Settings::audio_latency.Get() - Settings::video_latency.Get());
+    QElapsedTimer timer;
+    timer.start();
 
-    const std::chrono::microseconds time = DurationForBytes(m_start_offset) - setting_latency +
-            std::chrono::microseconds(m_audio_output->processedUSecs() - stretcher_latency_us);
+    m_renderer->RecordProcessedFrames(m_audio_output->GetFormat().framesForDuration(
+            m_audio_output->GetProcessedDuration().count()));
 
-    const std::chrono::microseconds last_speed_change = DurationForBytes(m_last_speed_change_offset);
-    const std::chrono::microseconds scaled_time = last_speed_change +
-            std::chrono::microseconds(static_cast<long long>(
-                    (time - last_speed_change).count() / m_stretcher->getTimeRatio()));
+    // The playback bar is in control of the position while scrubbing
+    if (m_scrubbing)
+        return;
 
-    const std::chrono::microseconds last_seek = DurationForBytes(m_last_seek_offset);
+    // The output frame that is being heard right now, and the frame of the file that it came from
+    const qint64 output_frame = GetOutputFrame();
+    const qint64 input_frame = std::max(m_renderer->GetInputFrame(output_frame),
+                                        m_renderer->GetLastSeekFrame());
 
-    emit TimeUpdated(std::max(scaled_time, last_seek), m_audio_file->GetDuration());
+    PublishClock(output_frame, input_frame);
+    emit TimeUpdated(DurationForFrames(input_frame), m_audio_file->GetDuration());
 
-    PushSamplesToOutput();
+    m_stats->notify_time_us.Record(timer.nsecsElapsed() / 1000);
 }
 
 void AudioOutputWorker::OnStateChanged(QAudio::State state)
 {
-#define CASE(n) case QAudio::State::n: qDebug() << "QAudioOutput state change:" << #n; break
+#define CASE(n) case QAudio::State::n: qDebug() << "Audio output state change:" << #n; break
     switch (state)
     {
         CASE(IdleState);
@@ -261,14 +458,30 @@ void AudioOutputWorker::OnStateChanged(QAudio::State state)
     }
 #undef CASE
 
-    // A transition to IdleState from ActiveState means a buffer underrun. When
-    // this happens we'll stop receiving `notify` events which normally drive
-    // our sample-pushing, so if we don't push more here, the audio will stop.
-    if (m_output_buffer && state == QAudio::State::IdleState)
+    // Waiting for the decoder or the stretcher is time that the user spends listening to silence
+    if (m_idle_timer.isValid())
+    {
+        m_stats->idle_time_us += m_idle_timer.nsecsElapsed() / 1000;
+        m_idle_timer.invalidate();
+    }
+    if (state == QAudio::State::IdleState && !IsAtEnd() && !m_scrubbing)
+        m_idle_timer.start();
+
+    // Scrubbing starts and stops the output behind the user's back
+    if (m_scrubbing)
+        return;
+
+    // The audio output keeps pulling in IdleState, so if it's waiting for the decoder,
+    // playback continues by itself. At the end of the file, it's time to stop.
+    if (state == QAudio::State::IdleState && IsAtEnd())
+    {
+        Stop();
+        state = QAudio::State::StoppedState;
+    }
+    else if (state != QAudio::State::StoppedState)
     {
-        qInfo() << "Audio playback buffer underrun, pushing more samples.";
-        PushSamplesToOutput();
-        state = m_audio_output->state(); // hopefully it's now Active again
+        // Let the clock know whether the position is moving
+        OnNotify();
     }
 
     PlaybackState simplified_state;
@@ -279,7 +492,7 @@ void AudioOutputWorker::OnStateChanged(QAudio::State state)
         break;
     case QAudio::State::SuspendedState:
     case QAudio::State::InterruptedState:
-    case QAudio::State::IdleState:   // Buffer underrun that wasn't fixed above
+    case QAudio::State::IdleState:   // Waiting for the decoder
         simplified_state = PlaybackState::Paused;
         break;
     case QAudio::State::StoppedState:
@@ -7,20 +7,30 @@
 #include <vector>
 
 #include <QAudio>
-#include <QAudioOutput>
+#include <QElapsedTimer>
 #include <QIODevice>
 #include <QObject>
-
-#include <RubberBandStretcher.h>
+#include <QTimer>
 
 #include "AudioFile.h"
+#include "AudioOutputDevice.h"
+#include "AudioRenderer.h"
+#include "AudioSink.h"
+#include "AudioStats.h"
+#include "KaraokeContainer/MappedFile.h"
+#include "PlaybackClock.h"
+#include "RealTimeStretcher.h"
+#include "StretchedAudio.h"
+#include "WaveformPeaks.h"
 
 class AudioOutputWorker final : public QObject
 {
     Q_OBJECT
 
 public:
-    explicit AudioOutputWorker(std::unique_ptr<QIODevice> io_device, QObject* parent = nullptr);
+    // The worker keeps the clock updated with the playback position, and records timings in stats
+    AudioOutputWorker(std::unique_ptr<KaraokeContainer::MappedFile> file, std::shared_ptr<PlaybackClock> clock,
+                      std::shared_ptr<AudioStats> stats, QObject* parent = nullptr);
 
     enum class PlaybackState
     {
@@ -36,34 +46,84 @@ public slots:
     void Pause();
     void Stop();
     void SetSpeed(double slowdown);
+    // Plays short snippets from around the given position, even if playback is paused or stopped
+    void Scrub(std::chrono::microseconds to);
+    // Seeks to the given position and goes back to the playback state from before scrubbing
+    void EndScrub(std::chrono::microseconds to);
+    // Starts playing the section from start to end over and over, until ClearLoop is called
+    // or the user seeks to outside of the section
+    void SetLoop(std::chrono::microseconds start, std::chrono::microseconds end);
+    void ClearLoop();
 
 signals:
     void LoadFinished(QString error);
+    void LoadProgress(std::chrono::microseconds decoded, std::chrono::microseconds length);
+    // Decoding failed partway through the file, after LoadFinished
+    void DecodeFailed(QString error);
+    // The loop from SetLoop has ended some other way than through ClearLoop,
+    // for instance by seeking to outside of it or by stopping
+    void LoopCleared();
+    void WaveformAvailable(std::shared_ptr<const WaveformPeaks> peaks);
     void PlaybackStateChanged(PlaybackState state);
     void TimeUpdated(std::chrono::microseconds current, std::chrono::microseconds length);
 
 private slots:
+    void OnDecodeProgress();
+    void OnPrerenderFinished();
     void OnNotify();
     void OnStateChanged(QAudio::State state);
 
 private:
-    bool PushSamplesToStretcher();
-    void PushSamplesToOutput();
-    std::chrono::microseconds DurationForBytes(qint32 bytes);
+    qint64 ReadOutput(char* data, qint64 max_size);
+    bool IsAtEnd() const;
+    // The output frame that is being heard right now
+    qint64 GetOutputFrame() const;
+    void PublishClock(qint64 output_frame, qint64 input_frame);
+    // Returns the prerendered audio for the current speed, or nullptr if it isn't finished
+    std::shared_ptr<StretchedAudio> FindPrerendered();
+    // Starts rendering the current speed ahead of time, unless it's already rendering
+    // or it isn't possible
+    void StartPrerendering();
+    bool CanPrerender() const;
+    // Makes an unfinished render stop, without waiting for its threads
+    void CancelPrerendered(std::shared_ptr<StretchedAudio> prerendered);
+    std::chrono::microseconds DurationForFrames(qint64 frames);
+    // Applies the stretcher settings. Only takes effect while stopped
+    void ConfigureStretcher();
+    // Emits LoopCleared if the renderer has stopped looping
+    void CheckLoop();
 
-    std::unique_ptr<QIODevice> m_io_device;
+    std::unique_ptr<KaraokeContainer::MappedFile> m_file;
+    std::shared_ptr<PlaybackClock> m_clock;
+    // Must outlive m_renderer
+    std::shared_ptr<AudioStats> m_stats;
     std::unique_ptr<AudioFile> m_audio_file;
-    std::unique_ptr<RubberBand::RubberBandStretcher> m_stretcher;
-    std::unique_ptr<QAudioOutput> m_audio_output;
-    std::vector<char> m_stretcher_buffer;
-    std::vector<std::vector<float>> m_stretcher_float_buffers;
-    std::vector<float*> m_stretcher_float_buffers_pointers;
-    QIODevice* m_output_buffer = nullptr;
-    qint32 m_start_offset;
-    qint32 m_current_offset;
-    qint32 m_last_seek_offset;
-    qint32 m_last_speed_change_offset;
+    // The most recently used speed comes last
+    std::vector<std::shared_ptr<StretchedAudio>> m_prerendered;
+    // Renders that have been cancelled, but whose threads may still be running.
+    // They're destroyed once the threads are done, so that nothing waits for them
+    std::vector<std::shared_ptr<StretchedAudio>> m_cancelled_prerendered;
+    // Restarted whenever the speed changes, and starts prerendering once it runs out
+    QTimer* m_prerender_timer = nullptr;
+    std::unique_ptr<AudioRenderer> m_renderer;
+    // Must outlive m_audio_output, which reads from it
+    std::unique_ptr<AudioOutputDevice> m_output_device;
+    std::unique_ptr<AudioSink> m_audio_output;
+
+    double m_time_ratio = 1.0;
+    // What the stretcher threads setting means when set to automatic, updated after each playback
+    RealTimeStretcher::Threading m_automatic_threading = RealTimeStretcher::Threading::Single;
+
+    // Runs while the output is in IdleState, waiting for audio
+    QElapsedTimer m_idle_timer;
+
+    bool m_decode_error_reported = false;
+    bool m_looping = false;
+
+    bool m_scrubbing = false;
+    QAudio::State m_state_before_scrub = QAudio::State::StoppedState;
 };
 
 Q_DECLARE_METATYPE(std::chrono::microseconds);
 Q_DECLARE_METATYPE(AudioOutputWorker::PlaybackState);
+Q_DECLARE_METATYPE(std::shared_ptr<const WaveformPeaks>);
@@ -0,0 +1,1043 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "AudioRenderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Interleave.h"
+
+// The most frames to render in one go, so that the lock doesn't get held for too long
+static constexpr size_t RENDER_BLOCK_FRAMES = 1024;
+// How long the rendering thread sleeps when the decoder is behind. The decoder doesn't
+// say when it has made progress, so that's the one thing the rendering thread polls for
+static constexpr std::chrono::milliseconds POLL_INTERVAL(2);
+// How long switching between the stretcher and the passthrough takes (about 10 ms)
+static constexpr size_t CROSSFADE_FRAMES = 512;
+// Scrubbing plays Hann-windowed grains overlapping by half, which add up to a constant gain.
+// The ring buffer is kept at no more than one hop (about 6 ms), so a new position gets heard quickly
+static constexpr size_t SCRUB_GRAIN_FRAMES = 512;
+static constexpr size_t SCRUB_HOP_FRAMES = SCRUB_GRAIN_FRAMES / 2;
+// How much audio from before the position the stretcher gets fed when it starts over,
+// so that it has settled down by the time it reaches the position (about 90 ms)
+static constexpr qint64 PREROLL_FRAMES = 4096;
+static constexpr double PI = 3.14159265358979323846;
+
+constexpr size_t AudioRenderer::MAX_ANCHORS;
+
+// Crossfades from the audio that follows the end of the loop into the start of the loop, which is
+// already in out. fade_position is how far into the crossfade the first frame is. Where source has
+// nothing past the end of the loop (at the end of the file), that side of the crossfade is silent
+template <typename Source>
+static void MixLoopCrossfade(Source& source, qint64 continuation_frame, size_t fade_position, size_t frames,
+                             size_t channel_count, const float** pointers, float* const* out)
+{
+    size_t mixed = 0;
+    while (mixed < frames)
+    {
+        const size_t read = source.GetFrames(continuation_frame + mixed, frames - mixed, pointers);
+        if (read == 0)
+            break;
+
+        for (size_t i = 0; i < channel_count; ++i)
+        {
+            for (size_t j = 0; j < read; ++j)
+            {
+                const float gain = float(fade_position + mixed + j + 1) / CROSSFADE_FRAMES;
+                out[i][mixed + j] = out[i][mixed + j] * gain + pointers[i][j] * (1.0f - gain);
+            }
+        }
+        mixed += read;
+    }
+
+    for (size_t i = 0; i < channel_count; ++i)
+    {
+        for (size_t j = mixed; j < frames; ++j)
+            out[i][j] *= float(fade_position + j + 1) / CROSSFADE_FRAMES;
+    }
+}
+
+void AudioRenderer::PlanarBuffer::Allocate(size_t channel_count, size_t frames)
+{
+    channels.resize(channel_count);
+    pointers.resize(channel_count);
+    for (size_t i = 0; i < channel_count; ++i)
+    {
+        channels[i].resize(frames);
+        pointers[i] = channels[i].data();
+    }
+}
+
+AudioRenderer::AudioRenderer(AudioFile* audio_file, int output_sample_rate, size_t buffer_frames, AudioStats* stats)
+    : m_audio_file(audio_file), m_channel_count(audio_file->GetPCMFormat().channelCount()),
+      m_output_sample_rate(output_sample_rate),
+      m_rate_ratio(static_cast<double>(output_sample_rate) / audio_file->GetPCMFormat().sampleRate()),
+      m_ring_buffer(buffer_frames * m_channel_count), m_stats(stats)
+{
+    m_stats->capacity_frames = m_ring_buffer.GetCapacity() / m_channel_count;
+
+    const QAudioFormat format = m_audio_file->GetPCMFormat();
+
+    // Allocated once, so that rendering never has to allocate memory
+    m_input_pointers.resize(m_channel_count);
+    m_offset_pointers.resize(m_channel_count);
+    m_render_buffer.Allocate(m_channel_count, RENDER_BLOCK_FRAMES);
+    m_crossfade_buffer.Allocate(m_channel_count, RENDER_BLOCK_FRAMES);
+    m_loop_feed_buffer.Allocate(m_channel_count, CROSSFADE_FRAMES);
+    m_discard_buffer.Allocate(m_channel_count, RENDER_BLOCK_FRAMES);
+    m_interleaved_buffer.resize(RENDER_BLOCK_FRAMES * m_channel_count);
+    m_grain_buffer.Allocate(m_channel_count, SCRUB_GRAIN_FRAMES);
+    m_grain_tail_buffer.Allocate(m_channel_count, SCRUB_HOP_FRAMES);
+
+    if (output_sample_rate != format.sampleRate())
+    {
+        m_resampler = Resampler::Create(m_channel_count, format.sampleRate(), output_sample_rate);
+        m_grain_resampler = Resampler::Create(m_channel_count, format.sampleRate(), output_sample_rate);
+    }
+    m_resample_buffer.Allocate(m_channel_count, RENDER_BLOCK_FRAMES);
+
+    // With resampling, a grain takes a little more input than it has frames, since the resampler
+    // holds on to some of it
+    m_scrub_grain_input_frames = m_grain_resampler ?
+            static_cast<size_t>(std::ceil(SCRUB_GRAIN_FRAMES / m_rate_ratio)) + m_grain_resampler->GetMaxLatency() :
+            SCRUB_GRAIN_FRAMES;
+    m_scrub_hop_input_frames = m_grain_resampler ?
+            std::llround(SCRUB_HOP_FRAMES / m_rate_ratio) : static_cast<qint64>(SCRUB_HOP_FRAMES);
+    m_grain_input_buffer.Allocate(m_channel_count, m_scrub_grain_input_frames);
+
+    m_scrub_window.resize(SCRUB_GRAIN_FRAMES);
+    for (size_t i = 0; i < SCRUB_GRAIN_FRAMES; ++i)
+        m_scrub_window[i] = static_cast<float>(0.5 - 0.5 * std::cos(2 * PI * i / SCRUB_GRAIN_FRAMES));
+    // Counted in input frames, like the positions it's compared with
+    m_scrub_hold_frames = format.sampleRate() / 10;
+
+    m_stretcher = std::make_unique<RealTimeStretcher>(
+                format.sampleRate(), m_channel_count, RealTimeStretcher::Threading::Single,
+                RealTimeStretcher::GetQualityOptionsFromSettings(), 1.0 / m_rate_ratio);
+    m_stretcher->SetTimeRatio(GetOutputRatio());
+    AddAnchor(0, GetOutputRatio());
+
+    m_thread = std::thread(&AudioRenderer::Run, this);
+}
+
+AudioRenderer::~AudioRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+}
+
+void AudioRenderer::Start()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_output_frame = 0;
+        m_last_seek_frame = 0;
+        m_anchors.clear();
+        AddAnchor(0, GetOutputRatio());
+        m_active = true;
+
+        const Engine engine = m_prerendered ? Engine::Prerendered :
+                              NeedsStretching() ? Engine::Stretcher : Engine::Passthrough;
+        SwitchEngine(engine, 0, m_prerendered);
+        // There's nothing to fade out from
+        m_crossfade_frames = 0;
+        m_fade_in_frames = 0;
+    }
+    m_condition.notify_all();
+}
+
+void AudioRenderer::SetStretcherOptions(RealTimeStretcher::Threading threading,
+                                        RubberBand::RubberBandStretcher::Options quality_options)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (threading == m_stretcher->GetThreading() && quality_options == m_stretcher->GetQualityOptions())
+        return;
+
+    m_stretcher = std::make_unique<RealTimeStretcher>(
+                m_audio_file->GetPCMFormat().sampleRate(), m_channel_count, threading, quality_options,
+                1.0 / m_rate_ratio);
+    m_stretcher->SetTimeRatio(GetOutputRatio());
+}
+
+RealTimeStretcher::Threading AudioRenderer::ChooseStretcherThreading() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Without any measurements of the stretcher, stay with what we have. The load is measured
+    // as if on one thread either way, so it doesn't matter which threading it was measured with
+    if (m_stats->stretcher_load_percent.GetCount() == 0)
+        return m_stretcher->GetThreading();
+
+    return RealTimeStretcher::ChooseThreading(m_channel_count, m_stats->stretcher_load_percent.GetPercentile(99));
+}
+
+void AudioRenderer::Stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_active = false;
+    m_scrubbing = false;
+    // Playback starts over from the beginning, which is outside of the loop
+    m_loop_start = m_loop_end = 0;
+    m_stretcher_loop_fade = m_passthrough_loop_fade = 0;
+    m_prerendered_loop_fade = m_fading_prerendered_loop_fade = 0;
+    m_stretcher->Reset();
+    // The rendering thread can't be writing, since we're holding the lock
+    m_ring_buffer.Reset();
+    m_flush_position = 0;
+    m_skipped_frames = 0;
+    m_read_frames = 0;
+    m_seek_start_ns = -1;
+    m_read_seek_start_ns = -1;
+    m_finished = false;
+    Publish();
+}
+
+void AudioRenderer::Seek(qint64 frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        SeekLocked(frame);
+        StartSeekTimer();
+    }
+    m_condition.notify_all();
+}
+
+void AudioRenderer::Scrub(qint64 frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_scrubbing)
+        {
+            m_scrubbing = true;
+            for (std::vector<float>& channel : m_grain_tail_buffer.channels)
+                std::fill(channel.begin(), channel.end(), 0.0f);
+            Flush();
+        }
+        m_scrub_target_frame = frame;
+        m_scrub_target_changed = true;
+        m_finished = false;
+    }
+    m_condition.notify_all();
+}
+
+void AudioRenderer::StopScrubbing(qint64 frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_scrubbing = false;
+        SeekLocked(frame);
+        StartSeekTimer();
+    }
+    m_condition.notify_all();
+}
+
+void AudioRenderer::SetLoop(qint64 start, qint64 end)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_loop_start = start;
+        m_loop_end = end;
+        SeekLocked(start);
+        StartSeekTimer();
+    }
+    m_condition.notify_all();
+}
+
+void AudioRenderer::ClearLoop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_loop_start = 0;
+    m_loop_end = 0;
+    m_stretcher_loop_fade = m_passthrough_loop_fade = 0;
+    m_prerendered_loop_fade = m_fading_prerendered_loop_fade = 0;
+    Publish();
+}
+
+bool AudioRenderer::HasLoop() const
+{
+    return m_published_looping.load(std::memory_order_acquire);
+}
+
+void AudioRenderer::SeekLocked(qint64 frame)
+{
+    if (frame < m_loop_start || frame >= m_loop_end)
+        m_loop_start = m_loop_end = 0;
+
+    // Nothing that has been rendered from the old position gets heard, not even a crossfade
+    Flush();
+    if (m_crossfade_frames > 0 && m_fading_engine == Engine::Stretcher && m_engine != Engine::Stretcher)
+        m_stretcher->Reset();
+    m_crossfade_frames = 0;
+    m_fading_prerendered.reset();
+
+    if (m_engine == Engine::Stretcher)
+        RestartStretcher(frame);
+    else
+        m_stretcher_frame = frame;
+    ResetPassthrough(frame);
+    m_stretcher_loop_fade = 0;
+    m_prerendered_loop_fade = m_fading_prerendered_loop_fade = 0;
+    if (m_prerendered)
+        m_prerendered_frame = m_prerendered->StretchedFrame(frame);
+    m_fade_in_frames = CROSSFADE_FRAMES;
+    m_last_seek_frame = frame;
+    AddAnchor(frame, GetOutputRatio());
+    m_finished = false;
+}
+
+void AudioRenderer::Flush()
+{
+    // The rendering thread can't be writing, since we're holding the lock
+    m_flush_position.store(m_ring_buffer.GetWritePosition(), std::memory_order_release);
+}
+
+void AudioRenderer::SetTimeRatio(double time_ratio, std::shared_ptr<const StretchedAudio> prerendered)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Where the audio that has been rendered so far leaves off
+    const qint64 position = GetInputFrameLocked(m_output_frame);
+
+    const bool ratio_changed = time_ratio != m_time_ratio;
+    m_time_ratio = time_ratio;
+
+    const Engine engine = prerendered ? Engine::Prerendered :
+                          NeedsStretching() ? Engine::Stretcher : Engine::Passthrough;
+    if (engine == Engine::Stretcher && m_engine == Engine::Stretcher)
+        m_stretcher->SetTimeRatio(GetOutputRatio());
+    else if (engine != m_engine || prerendered != m_prerendered)
+        SwitchEngine(engine, position, std::move(prerendered));
+
+    if (ratio_changed)
+        AddAnchor(position, GetOutputRatio());
+}
+
+void AudioRenderer::OfferPrerendered(std::shared_ptr<const StretchedAudio> prerendered)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (prerendered->GetTimeRatio() != m_time_ratio || m_engine == Engine::Prerendered)
+        return;
+
+    SwitchEngine(Engine::Prerendered, GetInputFrameLocked(m_output_frame), std::move(prerendered));
+}
+
+void AudioRenderer::SwitchEngine(Engine engine, qint64 position,
+                                 std::shared_ptr<const StretchedAudio> prerendered)
+{
+    // If the old engine is the stretcher, it gets to play out what it has while fading out.
+    // (If the new engine also is the stretcher, the old output is about to be thrown away.)
+    m_fading_engine = m_engine;
+    m_crossfade_frames = m_engine == Engine::Stretcher && engine == Engine::Stretcher ? 0 : CROSSFADE_FRAMES;
+    m_fading_prerendered = std::move(m_prerendered);
+    m_fading_prerendered_frame = m_prerendered_frame;
+    m_fading_prerendered_loop_fade = m_prerendered_loop_fade;
+
+    m_engine = engine;
+    m_prerendered = std::move(prerendered);
+
+    switch (engine)
+    {
+    case Engine::Passthrough:
+        ResetPassthrough(position);
+        break;
+    case Engine::Stretcher:
+        RestartStretcher(position);
+        break;
+    case Engine::Prerendered:
+        m_prerendered_frame = m_prerendered->StretchedFrame(position);
+        m_prerendered_loop_fade = 0;
+        break;
+    }
+}
+
+void AudioRenderer::ResetPassthrough(qint64 position)
+{
+    m_passthrough_frame = position;
+    m_passthrough_loop_fade = 0;
+    if (m_resampler)
+    {
+        m_resampler->Reset();
+        m_resampler_tail_frames = m_resampler->GetMaxLatency();
+    }
+}
+
+void AudioRenderer::RestartStretcher(qint64 position)
+{
+    m_stretcher->Reset();
+    m_stretcher->SetTimeRatio(GetOutputRatio());
+
+    // The output for the pre-roll is thrown away along with the latency,
+    // so the first frame that gets heard is the one at position
+    const qint64 preroll = std::min(PREROLL_FRAMES, position);
+    m_stretcher_frame = position - preroll;
+    m_stretcher_loop_fade = 0;
+    m_discard_frames = m_stretcher->GetLatency() + static_cast<size_t>(std::llround(preroll * GetOutputRatio()));
+}
+
+qint64 AudioRenderer::GetInputFrame(qint64 output_frame) const
+{
+    // The frames that the output skipped never got counted as played
+    output_frame += m_skipped_frames.load(std::memory_order_relaxed);
+
+    qint64 anchor_output_frame, anchor_input_frame;
+    double anchor_time_ratio;
+    quint32 sequence_before, sequence_after;
+    do
+    {
+        sequence_before = m_published_sequence.load(std::memory_order_acquire);
+
+        // Use the latest anchor that the output frame has reached, like GetInputFrameLocked.
+        // The count is clamped, since it may be torn while Publish is running
+        size_t i = std::min(m_published_anchor_count.load(std::memory_order_relaxed), MAX_ANCHORS);
+        while (i > 1 && m_published_output_frames[i - 1].load(std::memory_order_relaxed) > output_frame)
+            --i;
+        anchor_output_frame = i > 0 ? m_published_output_frames[i - 1].load(std::memory_order_relaxed) : 0;
+        anchor_input_frame = i > 0 ? m_published_input_frames[i - 1].load(std::memory_order_relaxed) : 0;
+        anchor_time_ratio = i > 0 ? m_published_time_ratios[i - 1].load(std::memory_order_relaxed) : 1.0;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        sequence_after = m_published_sequence.load(std::memory_order_relaxed);
+    } while ((sequence_before & 1) || sequence_before != sequence_after);
+
+    return anchor_input_frame + static_cast<qint64>((output_frame - anchor_output_frame) / anchor_time_ratio);
+}
+
+void AudioRenderer::StartSeekTimer()
+{
+    // A seek that hasn't been heard yet is superseded by this one
+    m_read_seek_start_ns.store(-1, std::memory_order_relaxed);
+    // Published after the flush position, see Read
+    m_seek_start_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_release);
+}
+
+void AudioRenderer::RecordProcessedFrames(qint64 processed_frames)
+{
+    const qint64 seek_start_ns = m_read_seek_start_ns.load(std::memory_order_acquire);
+    if (seek_start_ns < 0)
+        return;
+    const qint64 seek_frame = m_read_seek_frame.load(std::memory_order_relaxed);
+    if (processed_frames <= seek_frame)
+        return;
+
+    qint64 expected = seek_start_ns;
+    if (!m_read_seek_start_ns.compare_exchange_strong(expected, -1, std::memory_order_relaxed))
+        return;
+
+    // This gets called every so often, so the frame was processed a little while ago,
+    // about as long ago as the frames processed after it last
+    const qint64 now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    const qint64 since_frame_ns = (processed_frames - 1 - seek_frame) * 1000000000 / m_output_sample_rate;
+    m_stats->seek_latency_us.Record(std::max<qint64>(0, now_ns - since_frame_ns - seek_start_ns) / 1000);
+}
+
+qint64 AudioRenderer::GetLastSeekFrame() const
+{
+    return m_published_last_seek_frame.load(std::memory_order_acquire);
+}
+
+size_t AudioRenderer::Read(float* out, size_t max_frames)
+{
+    // Loaded before the flush position, so that if a seek has happened, everything
+    // from before the seek gets discarded below
+    const qint64 seek_start_ns = m_seek_start_ns.load(std::memory_order_acquire);
+
+    const size_t skipped = m_ring_buffer.DiscardUntil(m_flush_position.load(std::memory_order_acquire));
+    if (skipped > 0)
+        m_skipped_frames.fetch_add(skipped / m_channel_count, std::memory_order_relaxed);
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    const size_t fill_frames = m_ring_buffer.GetReadable() / m_channel_count;
+    // While scrubbing, the ring buffer is kept almost empty on purpose
+    if (!m_scrubbing.load(std::memory_order_relaxed))
+    {
+        const size_t capacity_frames = m_ring_buffer.GetCapacity() / m_channel_count;
+        m_stats->fill_percent.Record(static_cast<qint64>(fill_frames * 100 / capacity_frames));
+        if (fill_frames < m_stats->min_fill_frames.load(std::memory_order_relaxed))
+            m_stats->min_fill_frames.store(fill_frames, std::memory_order_relaxed);
+        if (fill_frames < max_frames && !m_finished.load(std::memory_order_acquire))
+            m_stats->underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const size_t frames = std::min(fill_frames, max_frames);
+    const size_t read = m_ring_buffer.Read(out, frames * m_channel_count) / m_channel_count;
+    if (read > 0 && m_waiting_for_space.load(std::memory_order_acquire))
+        WakeForSpace();
+    // Only the output changes this, apart from Stop
+    const qint64 read_frames = m_read_frames.fetch_add(static_cast<qint64>(read), std::memory_order_relaxed);
+
+    // The first frame from the new position is on its way to the sound device. The seek has
+    // been heard once the device has processed it, see RecordProcessedFrames
+    if (seek_start_ns >= 0 && read > 0)
+    {
+        qint64 expected = seek_start_ns;
+        if (m_seek_start_ns.compare_exchange_strong(expected, -1, std::memory_order_relaxed))
+        {
+            m_read_seek_frame.store(read_frames, std::memory_order_relaxed);
+            m_read_seek_start_ns.store(seek_start_ns, std::memory_order_release);
+        }
+    }
+
+    m_stats->output_read_time_us.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_time).count());
+    return read;
+}
+
+void AudioRenderer::WakeForSpace()
+{
+    // The rendering thread checks for space and goes to sleep with the lock held, so a notification
+    // sent in between would get lost. Holding the lock here rules that out. If something else holds
+    // the lock, the next read tries again, which is better than making the output wait
+    std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+
+    m_waiting_for_space.store(false, std::memory_order_relaxed);
+    lock.unlock();
+    m_condition.notify_all();
+}
+
+bool AudioRenderer::IsFinished() const
+{
+    return m_finished.load(std::memory_order_acquire) && m_ring_buffer.GetReadable() == 0;
+}
+
+void AudioRenderer::Run()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_quit)
+            return;
+
+        const auto start_time = std::chrono::steady_clock::now();
+        if (m_active && Render())
+        {
+            m_stats->render_time_us.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start_time).count());
+        }
+        else if (!m_active || (m_finished && !m_scrubbing))
+        {
+            // Nothing to do until playback starts or moves somewhere else, which notifies
+            m_condition.wait(lock);
+        }
+        else if (IsRingBufferFull())
+        {
+            // Read wakes us up once the output has made room
+            m_waiting_for_space.store(true, std::memory_order_release);
+            m_condition.wait(lock);
+            m_waiting_for_space.store(false, std::memory_order_relaxed);
+        }
+        else
+        {
+            m_condition.wait_for(lock, POLL_INTERVAL);
+        }
+    }
+}
+
+bool AudioRenderer::IsRingBufferFull() const
+{
+    // While scrubbing, the ring buffer is kept at no more than one hop
+    if (m_scrubbing)
+        return (m_ring_buffer.GetCapacity() - m_ring_buffer.GetWritable()) / m_channel_count >= SCRUB_HOP_FRAMES;
+
+    return m_ring_buffer.GetWritable() < m_channel_count;
+}
+
+bool AudioRenderer::Render()
+{
+    if (m_scrubbing)
+        return RenderScrub();
+
+    const size_t writable_frames = std::min(m_ring_buffer.GetWritable() / m_channel_count,
+                                            RENDER_BLOCK_FRAMES);
+    if (writable_frames == 0)
+        return false;
+
+    float* const* out = m_render_buffer.pointers.data();
+    const size_t frames = RenderEngine(m_engine, writable_frames, out);
+    if (frames == 0)
+    {
+        // If the decoder is behind, we have to wait, but at the end of the file, we're done
+        if (IsEngineAtEnd(m_engine))
+            m_finished = true;
+        return false;
+    }
+
+    if (m_crossfade_frames > 0)
+    {
+        const size_t fade_frames = std::min(frames, m_crossfade_frames);
+        float* const* fade_out = m_crossfade_buffer.pointers.data();
+        const size_t faded = m_fading_engine == Engine::Prerendered ?
+                RenderPrerendered(m_fading_prerendered.get(), &m_fading_prerendered_frame,
+                                  &m_fading_prerendered_loop_fade, fade_frames, fade_out) :
+                RenderEngine(m_fading_engine, fade_frames, fade_out);
+        // If the old engine runs dry early, it just fades out a little faster
+        for (size_t i = 0; i < m_channel_count; ++i)
+            std::fill(fade_out[i] + faded, fade_out[i] + fade_frames, 0.0f);
+
+        const size_t fade_position = CROSSFADE_FRAMES - m_crossfade_frames;
+        for (size_t i = 0; i < m_channel_count; ++i)
+        {
+            for (size_t j = 0; j < fade_frames; ++j)
+            {
+                const float gain = float(fade_position + j + 1) / CROSSFADE_FRAMES;
+                out[i][j] = out[i][j] * gain + fade_out[i][j] * (1.0f - gain);
+            }
+        }
+
+        m_crossfade_frames -= fade_frames;
+        if (m_crossfade_frames == 0)
+        {
+            if (m_engine != Engine::Stretcher)
+                m_stretcher->Reset();
+            m_fading_prerendered.reset();
+        }
+    }
+
+    if (m_fade_in_frames > 0)
+    {
+        const size_t fade_frames = std::min(frames, m_fade_in_frames);
+        const size_t fade_position = CROSSFADE_FRAMES - m_fade_in_frames;
+        for (size_t i = 0; i < m_channel_count; ++i)
+        {
+            for (size_t j = 0; j < fade_frames; ++j)
+                out[i][j] *= float(fade_position + j + 1) / CROSSFADE_FRAMES;
+        }
+        m_fade_in_frames -= fade_frames;
+    }
+
+    Interleave::Interleave(out, frames, m_interleaved_buffer.data(), m_channel_count);
+    m_ring_buffer.Write(m_interleaved_buffer.data(), frames * m_channel_count);
+    m_output_frame += frames;
+
+    return true;
+}
+
+bool AudioRenderer::RenderScrub()
+{
+    if (IsRingBufferFull())
+        return false;
+
+    // Jump to where the mouse is, or if it hasn't moved, keep playing for a little while
+    if (m_scrub_target_changed)
+        m_scrub_frame = m_scrub_target_frame;
+    else
+        m_scrub_frame += m_scrub_hop_input_frames;
+    m_scrub_target_changed = false;
+
+    float* const* grain = m_grain_buffer.pointers.data();
+    size_t read_frames = 0;
+    if (m_scrub_frame - m_scrub_target_frame < m_scrub_hold_frames)
+    {
+        float* const* grain_input = m_grain_resampler ? m_grain_input_buffer.pointers.data() : grain;
+        while (read_frames < m_scrub_grain_input_frames)
+        {
+            const size_t read = m_audio_file->GetFrames(m_scrub_frame + read_frames,
+                                                        m_scrub_grain_input_frames - read_frames,
+                                                        m_input_pointers.data());
+            if (read == 0)
+                break;
+
+            for (size_t i = 0; i < m_channel_count; ++i)
+                std::memcpy(grain_input[i] + read_frames, m_input_pointers[i], read * sizeof(float));
+            read_frames += read;
+        }
+
+        if (m_grain_resampler)
+        {
+            // The next grain starts somewhere else, so each grain is resampled on its own
+            for (size_t i = 0; i < m_channel_count; ++i)
+                std::fill(grain_input[i] + read_frames, grain_input[i] + m_scrub_grain_input_frames, 0.0f);
+            m_grain_resampler->Reset();
+            size_t input_frames = m_scrub_grain_input_frames;
+            read_frames = SCRUB_GRAIN_FRAMES;
+            m_grain_resampler->Process(grain_input, &input_frames, grain, &read_frames);
+        }
+    }
+
+    float* const* tail = m_grain_tail_buffer.pointers.data();
+    float* const* out = m_render_buffer.pointers.data();
+    for (size_t i = 0; i < m_channel_count; ++i)
+    {
+        // Whatever couldn't be read (not decoded yet, or past the end) is silence
+        std::fill(grain[i] + read_frames, grain[i] + SCRUB_GRAIN_FRAMES, 0.0f);
+        for (size_t j = 0; j < SCRUB_GRAIN_FRAMES; ++j)
+            grain[i][j] *= m_scrub_window[j];
+
+        for (size_t j = 0; j < SCRUB_HOP_FRAMES; ++j)
+            out[i][j] = tail[i][j] + grain[i][j];
+        std::memcpy(tail[i], grain[i] + SCRUB_HOP_FRAMES, SCRUB_HOP_FRAMES * sizeof(float));
+    }
+
+    Interleave::Interleave(out, SCRUB_HOP_FRAMES, m_interleaved_buffer.data(), m_channel_count);
+    m_ring_buffer.Write(m_interleaved_buffer.data(), SCRUB_HOP_FRAMES * m_channel_count);
+    m_output_frame += SCRUB_HOP_FRAMES;
+
+    return true;
+}
+
+size_t AudioRenderer::RenderEngine(Engine engine, size_t frames, float* const* out)
+{
+    switch (engine)
+    {
+    case Engine::Passthrough:
+        return RenderPassthrough(frames, out);
+    case Engine::Stretcher:
+        return RenderStretched(frames, out);
+    case Engine::Prerendered:
+        return RenderPrerendered(m_prerendered.get(), &m_prerendered_frame, &m_prerendered_loop_fade, frames, out);
+    }
+
+    return 0;
+}
+
+bool AudioRenderer::IsEngineAtEnd(Engine engine) const
+{
+    switch (engine)
+    {
+    case Engine::Passthrough:
+        return m_audio_file->IsDecodingFinished() && m_passthrough_frame == m_audio_file->GetDecodedFrames() &&
+               (!m_resampler || m_resampler_tail_frames == 0);
+    case Engine::Stretcher:
+        return m_stretcher->Available() < 0;
+    case Engine::Prerendered:
+        return m_prerendered_frame >= m_prerendered->GetFrameCount();
+    }
+
+    return true;
+}
+
+bool AudioRenderer::NeedsStretching() const
+{
+    // The passthrough can resample, unless the resampler couldn't be set up
+    return m_time_ratio != 1.0 || (m_rate_ratio != 1.0 && !m_resampler);
+}
+
+size_t AudioRenderer::RenderPassthrough(size_t frames, float* const* out)
+{
+    if (m_resampler)
+        return RenderResampled(frames, out);
+
+    size_t rendered = 0;
+    while (rendered < frames)
+    {
+        if (IsLooping() && m_passthrough_frame >= m_loop_end)
+        {
+            m_passthrough_frame = m_loop_start;
+            m_passthrough_loop_fade = GetLoopCrossfadeFrames();
+            if (m_engine == Engine::Passthrough)
+                AddLoopAnchor();
+        }
+
+        size_t max_frames = frames - rendered;
+        if (IsLooping())
+            max_frames = std::min(max_frames, static_cast<size_t>(m_loop_end - m_passthrough_frame));
+        const size_t read = m_audio_file->GetFrames(m_passthrough_frame, max_frames, m_input_pointers.data());
+        if (read == 0)
+            break;
+
+        for (size_t i = 0; i < m_channel_count; ++i)
+            std::memcpy(out[i] + rendered, m_input_pointers[i], read * sizeof(float));
+
+        if (m_passthrough_loop_fade > 0)
+        {
+            const size_t fade_frames = std::min(read, m_passthrough_loop_fade);
+            for (size_t i = 0; i < m_channel_count; ++i)
+                m_offset_pointers[i] = out[i] + rendered;
+            MixLoopCrossfade(*m_audio_file, m_passthrough_frame + (m_loop_end - m_loop_start),
+                             CROSSFADE_FRAMES - m_passthrough_loop_fade, fade_frames, m_channel_count,
+                             m_input_pointers.data(), m_offset_pointers.data());
+            m_passthrough_loop_fade -= fade_frames;
+        }
+
+        m_passthrough_frame += read;
+        rendered += read;
+    }
+
+    return rendered;
+}
+
+size_t AudioRenderer::RenderResampled(size_t frames, float* const* out)
+{
+    float* const* input = m_resample_buffer.pointers.data();
+    size_t rendered = 0;
+    while (rendered < frames)
+    {
+        if (IsLooping() && m_passthrough_frame >= m_loop_end)
+        {
+            m_passthrough_frame = m_loop_start;
+            m_passthrough_loop_fade = GetLoopCrossfadeFrames();
+            if (m_engine == Engine::Passthrough)
+                AddLoopAnchor();
+        }
+
+        // About as much input as the rest of the output takes. Whatever the resampler
+        // doesn't read gets read again next time
+        size_t max_frames = std::min(RENDER_BLOCK_FRAMES, static_cast<size_t>(
+                std::ceil((frames - rendered) / m_rate_ratio)) + m_resampler->GetMaxLatency());
+        if (IsLooping())
+            max_frames = std::min(max_frames, static_cast<size_t>(m_loop_end - m_passthrough_frame));
+
+        size_t input_frames = m_audio_file->GetFrames(m_passthrough_frame, max_frames, m_input_pointers.data());
+        const bool flushing = input_frames == 0;
+        if (flushing)
+        {
+            // At the end of the file, silence pushes out what the resampler is holding on to
+            if (!m_audio_file->IsDecodingFinished() || m_passthrough_frame < m_audio_file->GetDecodedFrames() ||
+                m_resampler_tail_frames == 0)
+            {
+                break;
+            }
+
+            input_frames = std::min(m_resampler_tail_frames, RENDER_BLOCK_FRAMES);
+            for (size_t i = 0; i < m_channel_count; ++i)
+                std::fill(input[i], input[i] + input_frames, 0.0f);
+        }
+        else
+        {
+            for (size_t i = 0; i < m_channel_count; ++i)
+                std::memcpy(input[i], m_input_pointers[i], input_frames * sizeof(float));
+            if (m_passthrough_loop_fade > 0)
+            {
+                MixLoopCrossfade(*m_audio_file, m_passthrough_frame + (m_loop_end - m_loop_start),
+                                 CROSSFADE_FRAMES - m_passthrough_loop_fade,
+                                 std::min(input_frames, m_passthrough_loop_fade), m_channel_count,
+                                 m_input_pointers.data(), input);
+            }
+        }
+
+        for (size_t i = 0; i < m_channel_count; ++i)
+            m_offset_pointers[i] = out[i] + rendered;
+        size_t output_frames = frames - rendered;
+        m_resampler->Process(input, &input_frames, m_offset_pointers.data(), &output_frames);
+
+        if (flushing)
+        {
+            m_resampler_tail_frames -= std::min(input_frames, m_resampler_tail_frames);
+        }
+        else
+        {
+            m_passthrough_frame += input_frames;
+            m_passthrough_loop_fade -= std::min(input_frames, m_passthrough_loop_fade);
+        }
+        rendered += output_frames;
+
+        if (input_frames == 0 && output_frames == 0)
+            break;
+    }
+
+    return rendered;
+}
+
+size_t AudioRenderer::RenderStretched(size_t frames, float* const* out)
+{
+    size_t rendered = 0;
+    while (rendered < frames)
+    {
+        const int available = m_stretcher->Available();
+        if (available < 0)
+            break; // All samples have been retrieved
+
+        // If the stretcher has nothing for us and there's nothing to feed it with,
+        // the output will have to wait until the decoder catches up (or for good, at the end)
+        if (available == 0)
+        {
+            if (!PushSamplesToStretcher())
+                break;
+            continue;
+        }
+
+        if (m_discard_frames > 0)
+        {
+            const size_t discard = std::min({m_discard_frames, static_cast<size_t>(available),
+                                             RENDER_BLOCK_FRAMES});
+            m_discard_frames -= m_stretcher->Retrieve(m_discard_buffer.pointers.data(), discard);
+            continue;
+        }
+
+        for (size_t i = 0; i < m_channel_count; ++i)
+            m_offset_pointers[i] = out[i] + rendered;
+        const size_t retrieved = m_stretcher->Retrieve(
+                m_offset_pointers.data(), std::min(frames - rendered, static_cast<size_t>(available)));
+        if (retrieved == 0)
+            break;
+        rendered += retrieved;
+    }
+
+    return rendered;
+}
+
+size_t AudioRenderer::RenderPrerendered(const StretchedAudio* prerendered, qint64* position, size_t* loop_fade,
+                                        size_t frames, float* const* out)
+{
+    // GetFrames stops at the end of each segment of the prerendered audio, so it takes a loop either way
+    const bool looping = IsLooping();
+    const qint64 loop_start = prerendered->StretchedFrame(m_loop_start);
+    const qint64 loop_end = looping ? prerendered->StretchedFrame(m_loop_end) : prerendered->GetFrameCount();
+    size_t rendered = 0;
+    while (rendered < frames)
+    {
+        if (looping && *position >= loop_end)
+        {
+            *position = loop_start;
+            *loop_fade = GetLoopCrossfadeFrames();
+            if (m_engine == Engine::Prerendered && prerendered == m_prerendered.get())
+                AddLoopAnchor();
+        }
+
+        const size_t max_frames = std::min<size_t>(frames - rendered, std::max<qint64>(loop_end - *position, 0));
+        const size_t read = prerendered->GetFrames(*position, max_frames, m_input_pointers.data());
+        if (read == 0)
+            break;
+
+        for (size_t i = 0; i < m_channel_count; ++i)
+            std::memcpy(out[i] + rendered, m_input_pointers[i], read * sizeof(float));
+
+        if (*loop_fade > 0)
+        {
+            const size_t fade_frames = std::min(read, *loop_fade);
+            for (size_t i = 0; i < m_channel_count; ++i)
+                m_offset_pointers[i] = out[i] + rendered;
+            MixLoopCrossfade(*prerendered, *position + (loop_end - loop_start), CROSSFADE_FRAMES - *loop_fade,
+                             fade_frames, m_channel_count, m_input_pointers.data(), m_offset_pointers.data());
+            *loop_fade -= fade_frames;
+        }
+
+        *position += read;
+        rendered += read;
+    }
+
+    return rendered;
+}
+
+bool AudioRenderer::PushSamplesToStretcher()
+{
+    // Read the finished flag before the watermark, so that if decoding has
+    // finished, we're guaranteed to see the final value of the watermark
+    const bool decoding_finished = m_audio_file->IsDecodingFinished();
+
+    // When looping, the start of the loop simply follows the end of it
+    if (IsLooping() && m_stretcher_frame >= m_loop_end)
+    {
+        m_stretcher_frame = m_loop_start;
+        m_stretcher_loop_fade = GetLoopCrossfadeFrames();
+        if (m_engine == Engine::Stretcher)
+            AddLoopAnchor();
+    }
+
+    size_t max_frames = m_stretcher->GetSamplesRequired();
+    if (IsLooping())
+        max_frames = std::min(max_frames, static_cast<size_t>(m_loop_end - m_stretcher_frame));
+    if (m_stretcher_loop_fade > 0)
+        max_frames = std::min(max_frames, m_stretcher_loop_fade);
+
+    // The stretcher reads straight from the PCM store, no conversion needed
+    const size_t frames = m_audio_file->GetFrames(m_stretcher_frame, max_frames, m_input_pointers.data());
+    if (frames == 0)
+        return false;
+
+    // Except right after jumping to the start of the loop, where the crossfade gets mixed into a buffer
+    const float* const* input = m_input_pointers.data();
+    if (m_stretcher_loop_fade > 0)
+    {
+        float* const* mixed = m_loop_feed_buffer.pointers.data();
+        for (size_t i = 0; i < m_channel_count; ++i)
+            std::memcpy(mixed[i], m_input_pointers[i], frames * sizeof(float));
+        MixLoopCrossfade(*m_audio_file, m_stretcher_frame + (m_loop_end - m_loop_start),
+                         CROSSFADE_FRAMES - m_stretcher_loop_fade, frames, m_channel_count,
+                         m_input_pointers.data(), mixed);
+        m_stretcher_loop_fade -= frames;
+        input = mixed;
+    }
+
+    m_stretcher_frame += frames;
+    const bool final = decoding_finished && !IsLooping() && m_stretcher_frame == m_audio_file->GetDecodedFrames();
+    const auto start_time = std::chrono::steady_clock::now();
+    m_stretcher->Process(input, frames, final);
+    m_stats->stretcher_process_time_us.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_time).count());
+
+    // The frames fed in last this long once stretched, which is the time the stretcher has for them
+    const double stretched_ns = frames * GetOutputRatio() * 1e9 / m_output_sample_rate;
+    m_stats->stretcher_load_percent.Record(static_cast<qint64>(
+            m_stretcher->GetLastProcessWork().count() * 100 / stretched_ns));
+
+    return true;
+}
+
+void AudioRenderer::AddAnchor(qint64 input_frame, double time_ratio)
+{
+    // Anchors that start at the same output frame as this one will never be used again
+    while (!m_anchors.empty() && m_anchors.back().output_frame >= m_output_frame)
+        m_anchors.pop_back();
+
+    m_anchors.push_back(Anchor{m_output_frame, input_frame, time_ratio});
+    if (m_anchors.size() > MAX_ANCHORS)
+        m_anchors.pop_front();
+    Publish();
+}
+
+void AudioRenderer::AddLoopAnchor()
+{
+    // The engine may be ahead of the output (the stretcher holds on to some audio), so work out
+    // at which output frame the end of the loop will be heard, going by the latest anchor
+    const Anchor& anchor = m_anchors.back();
+    const qint64 output_frame = anchor.output_frame + static_cast<qint64>(
+            std::llround((m_loop_end - anchor.input_frame) * anchor.time_ratio));
+
+    m_anchors.push_back(Anchor{std::max({output_frame, m_output_frame, anchor.output_frame}),
+                               m_loop_start, GetOutputRatio()});
+    if (m_anchors.size() > MAX_ANCHORS)
+        m_anchors.pop_front();
+    Publish();
+}
+
+void AudioRenderer::Publish()
+{
+    // Only one thread can be here at a time, since m_mutex is held
+    const quint32 sequence = m_published_sequence.load(std::memory_order_relaxed);
+    m_published_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < m_anchors.size(); ++i)
+    {
+        m_published_output_frames[i].store(m_anchors[i].output_frame, std::memory_order_relaxed);
+        m_published_input_frames[i].store(m_anchors[i].input_frame, std::memory_order_relaxed);
+        m_published_time_ratios[i].store(m_anchors[i].time_ratio, std::memory_order_relaxed);
+    }
+    m_published_anchor_count.store(m_anchors.size(), std::memory_order_relaxed);
+
+    m_published_sequence.store(sequence + 2, std::memory_order_release);
+
+    m_published_last_seek_frame.store(m_last_seek_frame, std::memory_order_release);
+    m_published_looping.store(IsLooping(), std::memory_order_release);
+}
+
+size_t AudioRenderer::GetLoopCrossfadeFrames() const
+{
+    // In low-memory mode, reading from past the end of the loop would make the decoder
+    // jump back and forth between there and the start, so the loop gets spliced instead
+    return m_audio_file->IsWindowed() ? 0 : CROSSFADE_FRAMES;
+}
+
+qint64 AudioRenderer::GetInputFrameLocked(qint64 output_frame) const
+{
+    // Use the latest anchor that the output frame has reached
+    auto it = m_anchors.rbegin();
+    while (it + 1 != m_anchors.rend() && it->output_frame > output_frame)
+        ++it;
+
+    return it->input_frame + static_cast<qint64>((output_frame - it->output_frame) / it->time_ratio);
+}
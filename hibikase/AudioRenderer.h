@@ -0,0 +1,286 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QtGlobal>
+
+#include "AudioFile.h"
+#include "AudioStats.h"
+#include "RealTimeStretcher.h"
+#include "Resampler.h"
+#include "RingBuffer.h"
+#include "StretchedAudio.h"
+
+// Runs the time-stretching on a dedicated thread, which writes interleaved
+// float frames into a ring buffer. The audio output only has to copy frames
+// out of the ring buffer, so it never waits for the stretcher, the decoder
+// or the event loop of any thread.
+//
+// At 100% speed, the stretcher is bypassed, and frames are copied straight from
+// the AudioFile, going through a Resampler if the output runs at a different
+// sample rate than the file. At other speeds, the stretcher does the resampling
+// as well, so that the audio only gets resampled once. Likewise, if the audio has
+// been stretched ahead of time for the current speed, frames are copied from that
+// StretchedAudio instead.
+// Switching between these engines crossfades between them. The stretcher can
+// process each channel on a thread of its own, see RealTimeStretcher.
+//
+// While the user is dragging the playback bar, short windowed grains of audio
+// from around the drag position are played instead, and the ring buffer is kept
+// almost empty so that the grains follow the mouse without much delay.
+class AudioRenderer final
+{
+public:
+    // The output is rendered at output_sample_rate, and buffer_frames are counted at that rate.
+    // The timings and fill levels get recorded in stats, which must outlive the AudioRenderer
+    AudioRenderer(AudioFile* audio_file, int output_sample_rate, size_t buffer_frames, AudioStats* stats);
+    ~AudioRenderer();
+
+    AudioRenderer(const AudioRenderer&) = delete;
+    AudioRenderer& operator=(const AudioRenderer&) = delete;
+
+    // These are called from the thread that controls playback
+
+    // Replaces the stretcher if the options have changed. Must not be called while rendering
+    void SetStretcherOptions(RealTimeStretcher::Threading threading,
+                             RubberBand::RubberBandStretcher::Options quality_options);
+    // Which threading the stretcher should use, judging by the stats of the playback so far
+    RealTimeStretcher::Threading ChooseStretcherThreading() const;
+    // Starts rendering from the beginning of the file
+    void Start();
+    // Stops rendering and throws away everything that has been rendered.
+    // The output must not be reading at the same time
+    void Stop();
+    // Throws away what has been rendered and continues from the given frame. If the stretcher
+    // is in use, it starts over, pre-rolled with the audio from just before the frame
+    void Seek(qint64 frame);
+    // Throws away what has been rendered and starts playing grains from around the given frame.
+    // Can be called as often as the position changes
+    void Scrub(qint64 frame);
+    // Throws away the grains and continues normal rendering from the given frame
+    void StopScrubbing(qint64 frame);
+    // Jumps to start and plays the frames [start, end) over and over. The end of the loop
+    // crossfades into the start, and the stretcher is fed across the loop boundary like it's
+    // one continuous stream, so there's no gap or click at any speed.
+    // Seeking to outside of the loop, or stopping, stops looping
+    void SetLoop(qint64 start, qint64 end);
+    void ClearLoop();
+    // False once the loop has been cleared, including by a seek. Doesn't wait for the rendering thread
+    bool HasLoop() const;
+    // prerendered may be nullptr. If not, it must be finished and have the same time ratio
+    void SetTimeRatio(double time_ratio, std::shared_ptr<const StretchedAudio> prerendered = nullptr);
+    // Switches to the prerendered audio if it matches the current time ratio
+    void OfferPrerendered(std::shared_ptr<const StretchedAudio> prerendered);
+    // Which frame of the audio file ends up at the given frame of the output,
+    // counting from the last call to Start. Doesn't wait for the rendering thread
+    qint64 GetInputFrame(qint64 output_frame) const;
+    // Doesn't wait for the rendering thread
+    qint64 GetLastSeekFrame() const;
+    // Called with how many frames the sound device has processed since Start. Records how long
+    // the last seek took to be heard, once the first frame after it has been processed
+    void RecordProcessedFrames(qint64 processed_frames);
+
+    // These are called from the audio output
+
+    // Copies up to max_frames interleaved frames to out. Returns the number of frames copied
+    size_t Read(float* out, size_t max_frames);
+    // True once everything up to the end of the file has been read
+    bool IsFinished() const;
+
+private:
+    // From output_frame onwards, each output frame advances the input by 1 / time_ratio frames
+    struct Anchor
+    {
+        qint64 output_frame;
+        qint64 input_frame;
+        double time_ratio;
+    };
+
+    // Old anchors are only needed until the output has caught up with the newer ones
+    static constexpr size_t MAX_ANCHORS = 64;
+
+    enum class Engine
+    {
+        Passthrough,
+        Stretcher,
+        Prerendered,
+    };
+
+    struct PlanarBuffer
+    {
+        std::vector<std::vector<float>> channels;
+        std::vector<float*> pointers;
+
+        void Allocate(size_t channel_count, size_t frames);
+    };
+
+    void Run();
+    // Called by Read when the rendering thread is waiting for room in the ring buffer
+    void WakeForSpace();
+    // The functions below must be called with m_mutex held
+
+    bool IsRingBufferFull() const;
+
+    // Returns false if there was nothing to do
+    bool Render();
+    bool RenderScrub();
+    // Write up to frames frames to out, and return how many were written
+    size_t RenderEngine(Engine engine, size_t frames, float* const* out);
+    size_t RenderPassthrough(size_t frames, float* const* out);
+    // The passthrough, when it has to resample
+    size_t RenderResampled(size_t frames, float* const* out);
+    size_t RenderStretched(size_t frames, float* const* out);
+    size_t RenderPrerendered(const StretchedAudio* prerendered, qint64* position, size_t* loop_fade,
+                             size_t frames, float* const* out);
+    bool IsEngineAtEnd(Engine engine) const;
+    bool NeedsStretching() const;
+    // Makes the passthrough continue from the given input frame
+    void ResetPassthrough(qint64 position);
+    // Makes engine the one being heard, starting from the given input frame,
+    // and fades out the old one
+    void SwitchEngine(Engine engine, qint64 position, std::shared_ptr<const StretchedAudio> prerendered);
+    bool PushSamplesToStretcher();
+    void SeekLocked(qint64 frame);
+    // Starts measuring the latency of a seek. Must be called after Flush
+    void StartSeekTimer();
+    // Resets the stretcher so that its first output is the given input frame
+    void RestartStretcher(qint64 position);
+    // Makes the output skip everything that has been written to the ring buffer so far
+    void Flush();
+    void AddAnchor(qint64 input_frame, double time_ratio);
+    // Copies the anchors, the last seek frame and whether there's a loop to where
+    // GetInputFrame, GetLastSeekFrame and HasLoop can read them without taking m_mutex
+    void Publish();
+    // Called when the engine being heard jumps from the end of the loop to the start
+    void AddLoopAnchor();
+    // How long the crossfade from the end of the loop to the start is
+    size_t GetLoopCrossfadeFrames() const;
+    bool IsLooping() const { return m_loop_end > m_loop_start; }
+    // How many output frames each input frame turns into
+    double GetOutputRatio() const { return m_time_ratio * m_rate_ratio; }
+    qint64 GetInputFrameLocked(qint64 output_frame) const;
+
+    AudioFile* m_audio_file;
+    const size_t m_channel_count;
+    const int m_output_sample_rate;
+    // The output sample rate divided by the sample rate of the file
+    const double m_rate_ratio;
+
+    RingBuffer<float> m_ring_buffer;
+    AudioStats* m_stats;
+    std::atomic<bool> m_finished{false};
+    // The ring buffer write position to skip ahead to, see Flush
+    std::atomic<size_t> m_flush_position{0};
+    // How many rendered frames the output has skipped since Start
+    std::atomic<qint64> m_skipped_frames{0};
+    // Written with m_mutex held, but also read by the output
+    std::atomic<bool> m_scrubbing{false};
+    // Whether the rendering thread is asleep until the output reads from the ring buffer
+    std::atomic<bool> m_waiting_for_space{false};
+    // When the last seek happened (in steady_clock nanoseconds), until the output reads
+    // the first frame after it. -1 if there's no seek to measure
+    std::atomic<qint64> m_seek_start_ns{-1};
+    // Once the output has read the first frame after the seek, the time of the seek moves here,
+    // until the sound device has processed the frame. -1 otherwise
+    std::atomic<qint64> m_read_seek_start_ns{-1};
+    // How many frames Read had returned since Start before the first frame after the seek
+    std::atomic<qint64> m_read_seek_frame{0};
+    // How many frames Read has returned since Start
+    std::atomic<qint64> m_read_frames{0};
+
+    // The rendering thread holds m_mutex while the stretcher runs, so the worker thread, which also
+    // runs the audio output, reads these copies instead. Written by Publish, with m_mutex held.
+    // The anchors are a seqlock, and the sequence number is odd while they are being updated
+    std::atomic<quint32> m_published_sequence{0};
+    std::array<std::atomic<qint64>, MAX_ANCHORS> m_published_output_frames;
+    std::array<std::atomic<qint64>, MAX_ANCHORS> m_published_input_frames;
+    std::array<std::atomic<double>, MAX_ANCHORS> m_published_time_ratios;
+    std::atomic<size_t> m_published_anchor_count{0};
+    std::atomic<qint64> m_published_last_seek_frame{0};
+    std::atomic<bool> m_published_looping{false};
+
+    // Everything below is protected by m_mutex
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_active = false;
+    bool m_quit = false;
+
+    std::unique_ptr<RealTimeStretcher> m_stretcher;
+    std::shared_ptr<const StretchedAudio> m_prerendered;
+    // The speed picked by the user, not counting the change of sample rate
+    double m_time_ratio = 1.0;
+    Engine m_engine = Engine::Passthrough;
+    // Output frames from a freshly reset stretcher are delayed by its latency, so they get thrown away
+    size_t m_discard_frames = 0;
+    // While this is non-zero, m_fading_engine is being faded out
+    size_t m_crossfade_frames = 0;
+    Engine m_fading_engine = Engine::Passthrough;
+    std::shared_ptr<const StretchedAudio> m_fading_prerendered;
+    qint64 m_fading_prerendered_frame = 0;
+    // While this is non-zero, the audio is fading in after scrubbing or jumping to a loop
+    size_t m_fade_in_frames = 0;
+
+    // Looping is off if the end isn't after the start
+    qint64 m_loop_start = 0;
+    qint64 m_loop_end = 0;
+
+    // The position the user has dragged to, and the position the next grain starts at
+    qint64 m_scrub_target_frame = 0;
+    qint64 m_scrub_frame = 0;
+    bool m_scrub_target_changed = false;
+    // When the mouse stops moving, playback continues for this long, and then goes quiet
+    qint64 m_scrub_hold_frames = 0;
+    std::vector<float> m_scrub_window;
+    // How many input frames a grain is made from, and how far apart the grains start
+    size_t m_scrub_grain_input_frames = 0;
+    qint64 m_scrub_hop_input_frames = 0;
+    PlanarBuffer m_grain_input_buffer;
+    PlanarBuffer m_grain_buffer;
+    // The second half of the previous grain, which overlaps with the first half of the next one
+    PlanarBuffer m_grain_tail_buffer;
+
+    // Used by the passthrough and the scrubbing when the output runs at a different sample rate
+    // than the file, nullptr otherwise. The grains each get resampled on their own
+    std::unique_ptr<Resampler> m_resampler;
+    std::unique_ptr<Resampler> m_grain_resampler;
+    // The input for m_resampler, with the loop crossfade mixed in
+    PlanarBuffer m_resample_buffer;
+    // How much silence m_resampler still needs at the end of the file to push out the rest of the audio
+    size_t m_resampler_tail_frames = 0;
+
+    std::vector<const float*> m_input_pointers;
+    std::vector<float*> m_offset_pointers;
+    PlanarBuffer m_render_buffer;
+    PlanarBuffer m_crossfade_buffer;
+    PlanarBuffer m_discard_buffer;
+    std::vector<float> m_interleaved_buffer;
+
+    // The next frame to feed to the stretcher, the next frame for the passthrough to copy,
+    // and the next frame to copy from the prerendered audio (in stretched coordinates)
+    qint64 m_stretcher_frame = 0;
+    qint64 m_passthrough_frame = 0;
+    qint64 m_prerendered_frame = 0;
+    // How many frames of the crossfade from the end of the loop to the start are left,
+    // for each of the positions above (and for m_fading_prerendered_frame)
+    size_t m_stretcher_loop_fade = 0;
+    size_t m_passthrough_loop_fade = 0;
+    size_t m_prerendered_loop_fade = 0;
+    size_t m_fading_prerendered_loop_fade = 0;
+    // The crossfaded input for the stretcher
+    PlanarBuffer m_loop_feed_buffer;
+    // How many frames have been written to the ring buffer since Start
+    qint64 m_output_frame = 0;
+    std::deque<Anchor> m_anchors;
+    qint64 m_last_seek_frame = 0;
+
+    std::thread m_thread;
+};
@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "AudioSink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include <QAudioDeviceInfo>
+#include <QDebug>
+
+// How often a real-time NullAudioSink pulls samples
+static constexpr std::chrono::milliseconds NULL_SINK_PULL_INTERVAL(5);
+
+std::unique_ptr<AudioSink> AudioSink::Create(const QAudioFormat& format, std::chrono::microseconds buffer_duration,
+                                             std::chrono::milliseconds notify_interval, QObject* parent)
+{
+    if (QAudioDeviceInfo::defaultOutputDevice().isNull())
+    {
+        qWarning() << "No audio output device found, playing to a null audio sink";
+        return std::make_unique<NullAudioSink>(format, NullAudioSink::Timing::RealTime,
+                                               buffer_duration, notify_interval, parent);
+    }
+
+    return std::make_unique<QtAudioSink>(format, buffer_duration, notify_interval, parent);
+}
+
+QAudioFormat AudioSink::GetNativeFormat(const QAudioFormat& format)
+{
+    const QAudioDeviceInfo device = QAudioDeviceInfo::defaultOutputDevice();
+    if (device.isNull())
+        return format;
+
+    QAudioFormat native_format = format;
+    native_format.setSampleRate(device.preferredFormat().sampleRate());
+    if (native_format.sampleRate() <= 0 || !device.isFormatSupported(native_format))
+        return format;
+
+    return native_format;
+}
+
+QtAudioSink::QtAudioSink(const QAudioFormat& format, std::chrono::microseconds buffer_duration,
+                         std::chrono::milliseconds notify_interval, QObject* parent)
+    : AudioSink(parent), m_output(format, this), m_buffer_bytes(format.bytesForDuration(buffer_duration.count()))
+{
+    m_output.setBufferSize(m_buffer_bytes);
+    m_output.setNotifyInterval(static_cast<int>(notify_interval.count()));
+
+    connect(&m_output, &QAudioOutput::stateChanged, this, &QtAudioSink::OnStateChanged);
+    connect(&m_output, &QAudioOutput::notify, this, &AudioSink::Notify);
+}
+
+void QtAudioSink::Start(QIODevice* device)
+{
+    m_device = device;
+    m_processed_before_flush = std::chrono::microseconds(0);
+    m_output.start(device);
+}
+
+void QtAudioSink::Stop()
+{
+    m_output.stop();
+    m_output.reset();
+    m_device = nullptr;
+    m_processed_before_flush = std::chrono::microseconds(0);
+}
+
+void QtAudioSink::Flush()
+{
+    const QAudio::State state = m_output.state();
+    if (state == QAudio::State::StoppedState)
+        return;
+
+    // QAudioOutput can only throw away its buffer by stopping. As far as the users
+    // of the sink are concerned, nothing happens, so the state changes are hidden
+    m_flushing = true;
+    m_processed_before_flush += std::chrono::microseconds(m_output.processedUSecs());
+    m_output.stop();
+    m_output.setBufferSize(m_buffer_bytes);
+    m_output.start(m_device);
+    if (state == QAudio::State::SuspendedState)
+        m_output.suspend();
+    m_flushing = false;
+
+    // Unless the output has ended up somewhere else, like IdleState if nothing was ready to play
+    ReportState(m_output.state());
+}
+
+void QtAudioSink::SetBufferDuration(std::chrono::microseconds buffer_duration)
+{
+    m_buffer_bytes = m_output.format().bytesForDuration(buffer_duration.count());
+    if (m_output.state() == QAudio::State::StoppedState)
+        m_output.setBufferSize(m_buffer_bytes);
+    else
+        Flush();
+}
+
+void QtAudioSink::Suspend()
+{
+    m_output.suspend();
+}
+
+void QtAudioSink::Resume()
+{
+    m_output.resume();
+}
+
+QAudio::State QtAudioSink::GetState() const
+{
+    return m_output.state();
+}
+
+QAudioFormat QtAudioSink::GetFormat() const
+{
+    return m_output.format();
+}
+
+std::chrono::microseconds QtAudioSink::GetProcessedDuration() const
+{
+    return m_processed_before_flush + std::chrono::microseconds(m_output.processedUSecs());
+}
+
+void QtAudioSink::OnStateChanged(QAudio::State state)
+{
+    // Some backends emit stateChanged from their own thread, so the changes made by Flush can
+    // arrive after it has returned. By then they no longer match the state of the output
+    if (m_flushing || state != m_output.state())
+        return;
+
+    ReportState(state);
+}
+
+void QtAudioSink::ReportState(QAudio::State state)
+{
+    if (state == m_reported_state)
+        return;
+
+    m_reported_state = state;
+    emit StateChanged(state);
+}
+
+NullAudioSink::NullAudioSink(const QAudioFormat& format, Timing timing, std::chrono::microseconds buffer_duration,
+                             std::chrono::milliseconds notify_interval, QObject* parent)
+    : AudioSink(parent), m_format(format), m_timing(timing),
+      m_notify_interval_frames(std::max<qint64>(1, format.framesForDuration(
+              std::chrono::duration_cast<std::chrono::microseconds>(notify_interval).count()))),
+      m_timer(this)
+{
+    m_buffer.resize(format.bytesForDuration(buffer_duration.count()));
+
+    m_timer.setTimerType(Qt::TimerType::PreciseTimer);
+    m_timer.setInterval(timing == Timing::RealTime ? static_cast<int>(NULL_SINK_PULL_INTERVAL.count()) : 0);
+    connect(&m_timer, &QTimer::timeout, this, &NullAudioSink::Pull);
+}
+
+void NullAudioSink::Start(QIODevice* device)
+{
+    m_device = device;
+    m_processed_frames = 0;
+    m_next_notify_frame = m_notify_interval_frames;
+    RestartClock();
+    m_timer.start();
+    SetState(QAudio::State::ActiveState);
+}
+
+void NullAudioSink::Stop()
+{
+    m_timer.stop();
+    m_device = nullptr;
+    m_processed_frames = 0;
+    SetState(QAudio::State::StoppedState);
+}
+
+void NullAudioSink::Flush()
+{
+    // Nothing is kept between pulls
+}
+
+void NullAudioSink::SetBufferDuration(std::chrono::microseconds buffer_duration)
+{
+    m_buffer.resize(m_format.bytesForDuration(buffer_duration.count()));
+}
+
+void NullAudioSink::Suspend()
+{
+    if (m_state != QAudio::State::ActiveState && m_state != QAudio::State::IdleState)
+        return;
+
+    m_timer.stop();
+    SetState(QAudio::State::SuspendedState);
+}
+
+void NullAudioSink::Resume()
+{
+    if (m_state != QAudio::State::SuspendedState)
+        return;
+
+    RestartClock();
+    m_timer.start();
+    SetState(QAudio::State::ActiveState);
+}
+
+QAudio::State NullAudioSink::GetState() const
+{
+    return m_state;
+}
+
+QAudioFormat NullAudioSink::GetFormat() const
+{
+    return m_format;
+}
+
+std::chrono::microseconds NullAudioSink::GetProcessedDuration() const
+{
+    return std::chrono::microseconds(m_format.durationForFrames(m_processed_frames));
+}
+
+void NullAudioSink::Pull()
+{
+    const qint64 bytes_per_frame = m_format.bytesPerFrame();
+    qint64 wanted_frames = static_cast<qint64>(m_buffer.size()) / bytes_per_frame;
+    if (m_timing == Timing::RealTime)
+    {
+        const qint64 due_frames = m_format.framesForDuration(m_clock.nsecsElapsed() / 1000);
+        wanted_frames = std::min(wanted_frames, due_frames - m_frames_since_clock_start);
+        if (wanted_frames <= 0)
+            return;
+    }
+
+    const qint64 read_bytes = m_device->read(m_buffer.data(), wanted_frames * bytes_per_frame);
+    const qint64 read_frames = std::max<qint64>(0, read_bytes) / bytes_per_frame;
+    m_processed_frames += read_frames;
+    m_frames_since_clock_start += read_frames;
+
+    // Like a sound device, don't try to catch up after running dry
+    if (read_frames < wanted_frames)
+    {
+        RestartClock();
+        SetState(QAudio::State::IdleState);
+    }
+    else
+    {
+        SetState(QAudio::State::ActiveState);
+    }
+
+    while (m_processed_frames >= m_next_notify_frame)
+    {
+        m_next_notify_frame += m_notify_interval_frames;
+        emit Notify();
+    }
+}
+
+void NullAudioSink::SetState(QAudio::State state)
+{
+    if (state == m_state)
+        return;
+
+    m_state = state;
+    emit StateChanged(state);
+}
+
+void NullAudioSink::RestartClock()
+{
+    m_clock.start();
+    m_frames_since_clock_start = 0;
+}
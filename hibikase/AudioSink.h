@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <QAudio>
+#include <QAudioFormat>
+#include <QAudioOutput>
+#include <QElapsedTimer>
+#include <QIODevice>
+#include <QObject>
+#include <QTimer>
+
+// Where the audio ends up. Pulls samples from a QIODevice, like QAudioOutput.
+// AudioOutputWorker only uses this interface, so that the whole pipeline
+// can also run on a computer without a sound device.
+class AudioSink : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Uses the default sound device, or a NullAudioSink running in real time if there is none
+    static std::unique_ptr<AudioSink> Create(const QAudioFormat& format, std::chrono::microseconds buffer_duration,
+                                             std::chrono::milliseconds notify_interval, QObject* parent = nullptr);
+    // format with the sample rate changed to the one the default sound device runs at, if the device
+    // supports that. Otherwise, the operating system would have to resample, adding latency
+    static QAudioFormat GetNativeFormat(const QAudioFormat& format);
+
+    using QObject::QObject;
+
+    virtual void Start(QIODevice* device) = 0;
+    // Also throws away whatever has been buffered
+    virtual void Stop() = 0;
+    // Throws away whatever has been buffered but keeps going, without changing the state
+    // or GetProcessedDuration. The next samples are pulled from the device right away
+    virtual void Flush() = 0;
+    // Changes how much audio gets buffered. If the sink is running, whatever has been
+    // buffered is thrown away, like with Flush
+    virtual void SetBufferDuration(std::chrono::microseconds buffer_duration) = 0;
+    virtual void Suspend() = 0;
+    virtual void Resume() = 0;
+
+    virtual QAudio::State GetState() const = 0;
+    virtual QAudioFormat GetFormat() const = 0;
+    // How much audio has been pulled from the device since Start
+    virtual std::chrono::microseconds GetProcessedDuration() const = 0;
+
+signals:
+    void StateChanged(QAudio::State state);
+    // Emitted every notify interval of processed audio
+    void Notify();
+};
+
+class QtAudioSink final : public AudioSink
+{
+    Q_OBJECT
+
+public:
+    QtAudioSink(const QAudioFormat& format, std::chrono::microseconds buffer_duration,
+                std::chrono::milliseconds notify_interval, QObject* parent = nullptr);
+
+    void Start(QIODevice* device) override;
+    void Stop() override;
+    void Flush() override;
+    void SetBufferDuration(std::chrono::microseconds buffer_duration) override;
+    void Suspend() override;
+    void Resume() override;
+
+    QAudio::State GetState() const override;
+    QAudioFormat GetFormat() const override;
+    std::chrono::microseconds GetProcessedDuration() const override;
+
+private slots:
+    void OnStateChanged(QAudio::State state);
+
+private:
+    // Emits StateChanged if the state differs from the one that was last reported
+    void ReportState(QAudio::State state);
+
+    QAudioOutput m_output;
+    // QAudioOutput only applies a new buffer size when it starts
+    int m_buffer_bytes;
+    QIODevice* m_device = nullptr;
+    // What was processed before the output was last restarted by Flush
+    std::chrono::microseconds m_processed_before_flush{0};
+    // The state changes caused by Flush are hidden from the users of the sink
+    bool m_flushing = false;
+    QAudio::State m_reported_state = QAudio::State::StoppedState;
+};
+
+// Pulls samples and throws them away, either at the speed a sound device would
+// or as fast as the device can provide them. Used when there's no sound device
+// and for benchmarking.
+class NullAudioSink final : public AudioSink
+{
+    Q_OBJECT
+
+public:
+    enum class Timing
+    {
+        RealTime,
+        AsFastAsPossible,
+    };
+
+    NullAudioSink(const QAudioFormat& format, Timing timing, std::chrono::microseconds buffer_duration,
+                  std::chrono::milliseconds notify_interval, QObject* parent = nullptr);
+
+    void Start(QIODevice* device) override;
+    void Stop() override;
+    void Flush() override;
+    void SetBufferDuration(std::chrono::microseconds buffer_duration) override;
+    void Suspend() override;
+    void Resume() override;
+
+    QAudio::State GetState() const override;
+    QAudioFormat GetFormat() const override;
+    std::chrono::microseconds GetProcessedDuration() const override;
+
+private slots:
+    void Pull();
+
+private:
+    void SetState(QAudio::State state);
+    void RestartClock();
+
+    const QAudioFormat m_format;
+    const Timing m_timing;
+    const qint64 m_notify_interval_frames;
+
+    QIODevice* m_device = nullptr;
+    QAudio::State m_state = QAudio::State::StoppedState;
+    QTimer m_timer;
+    std::vector<char> m_buffer;
+
+    qint64 m_processed_frames = 0;
+    qint64 m_next_notify_frame = 0;
+    // In real time, frames are due at the sample rate, counting from when the clock was last restarted
+    QElapsedTimer m_clock;
+    qint64 m_frames_since_clock_start = 0;
+};
@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "AudioStats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <initializer_list>
+#include <memory>
+
+#include <QString>
+#include <QStringList>
+
+Histogram::Histogram(std::initializer_list<qint64> upper_bounds)
+    : m_upper_bounds(upper_bounds), m_counts(new std::atomic<quint64>[upper_bounds.size() + 1])
+{
+    Reset();
+}
+
+void Histogram::Record(qint64 value)
+{
+    const size_t bucket = std::lower_bound(m_upper_bounds.begin(), m_upper_bounds.end(), value) -
+                          m_upper_bounds.begin();
+    m_counts[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    qint64 max = m_max.load(std::memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Histogram::Reset()
+{
+    for (size_t i = 0; i <= m_upper_bounds.size(); ++i)
+        m_counts[i].store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+quint64 Histogram::GetCount() const
+{
+    quint64 count = 0;
+    for (size_t i = 0; i <= m_upper_bounds.size(); ++i)
+        count += m_counts[i].load(std::memory_order_relaxed);
+    return count;
+}
+
+qint64 Histogram::GetMax() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+qint64 Histogram::GetPercentile(int percent) const
+{
+    const quint64 target = (GetCount() * percent + 99) / 100;
+    quint64 count = 0;
+    for (size_t i = 0; i < m_upper_bounds.size(); ++i)
+    {
+        count += m_counts[i].load(std::memory_order_relaxed);
+        if (count >= target)
+            return std::min(m_upper_bounds[i], GetMax());
+    }
+
+    return GetMax();
+}
+
+QString Histogram::Format(const QString& unit) const
+{
+    const quint64 total = GetCount();
+    if (total == 0)
+        return QStringLiteral("  (no data)\n");
+
+    QString result = QStringLiteral("  %1 samples, median <= %2 %4, 99th percentile <= %3 %4, max %5 %4\n")
+            .arg(total).arg(GetPercentile(50)).arg(GetPercentile(99)).arg(unit).arg(GetMax());
+
+    for (size_t i = 0; i <= m_upper_bounds.size(); ++i)
+    {
+        const quint64 count = m_counts[i].load(std::memory_order_relaxed);
+        if (count == 0)
+            continue;
+
+        const QString bucket = i < m_upper_bounds.size() ?
+                QStringLiteral("<= %1 %2").arg(m_upper_bounds[i]).arg(unit) :
+                QStringLiteral(" > %1 %2").arg(m_upper_bounds.back()).arg(unit);
+        result += QStringLiteral("  %1: %2 (%3%)\n").arg(bucket, 12).arg(count, 8)
+                .arg(100.0 * count / total, 5, 'f', 1);
+    }
+
+    return result;
+}
+
+void AudioStats::Reset()
+{
+    render_time_us.Reset();
+    stretcher_process_time_us.Reset();
+    stretcher_load_percent.Reset();
+    output_read_time_us.Reset();
+    notify_time_us.Reset();
+    seek_latency_us.Reset();
+    fill_percent.Reset();
+    underruns = 0;
+    min_fill_frames = static_cast<size_t>(-1);
+    idle_time_us = 0;
+}
+
+QString AudioStats::Dump() const
+{
+    const size_t min_fill = min_fill_frames.load();
+
+    QString result;
+    result += QStringLiteral("Underruns: %1\n").arg(underruns.load());
+    result += QStringLiteral("Time spent waiting for audio: %1 ms\n").arg(idle_time_us.load() / 1000);
+    result += QStringLiteral("Lowest buffer fill level: %1 of %2 frames\n")
+            .arg(min_fill == static_cast<size_t>(-1) ? QStringLiteral("-") : QString::number(min_fill))
+            .arg(capacity_frames.load());
+    result += QStringLiteral("\nBuffer fill level when the output reads:\n") + fill_percent.Format(QStringLiteral("%"));
+    result += QStringLiteral("\nRendering time per block:\n") + render_time_us.Format(QStringLiteral("us"));
+    result += QStringLiteral("\nStretcher processing time per call:\n") +
+              stretcher_process_time_us.Format(QStringLiteral("us"));
+    result += QStringLiteral("\nStretcher load on one thread:\n") + stretcher_load_percent.Format(QStringLiteral("%"));
+    result += QStringLiteral("\nOutput copy time per read:\n") + output_read_time_us.Format(QStringLiteral("us"));
+    result += QStringLiteral("\nNotify handling time:\n") + notify_time_us.Format(QStringLiteral("us"));
+    result += QStringLiteral("\nTime from seeking until the new position is played:\n") +
+              seek_latency_us.Format(QStringLiteral("us"));
+
+    return result;
+}
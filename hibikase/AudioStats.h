@@ -0,0 +1,79 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <atomic>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include <QString>
+#include <QtGlobal>
+
+// Counts how many values fall into each bucket. Record is lock-free and
+// allocation-free, so it can be used on the audio threads.
+class Histogram final
+{
+public:
+    // Bucket i counts values up to and including upper_bounds[i]. One more bucket counts everything bigger
+    Histogram(std::initializer_list<qint64> upper_bounds);
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void Record(qint64 value);
+    void Reset();
+
+    quint64 GetCount() const;
+    qint64 GetMax() const;
+    // The upper bound of the bucket that the given percentile falls into, or GetMax for the last bucket
+    qint64 GetPercentile(int percent) const;
+    // One line per non-empty bucket
+    QString Format(const QString& unit) const;
+
+private:
+    const std::vector<qint64> m_upper_bounds;
+    std::unique_ptr<std::atomic<quint64>[]> m_counts;
+    std::atomic<qint64> m_max{0};
+};
+
+// Where the time goes on the audio path, and how close the output comes to running dry.
+// Written by the rendering thread, the audio output and the worker thread, and read by
+// the diagnostics dialog
+class AudioStats final
+{
+public:
+    AudioStats() = default;
+
+    AudioStats(const AudioStats&) = delete;
+    AudioStats& operator=(const AudioStats&) = delete;
+
+    void Reset();
+    // A human-readable summary of everything
+    QString Dump() const;
+
+    // How long the rendering thread takes to render one block, in microseconds
+    Histogram render_time_us{20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000};
+    // How long one call to the stretcher's process function takes, in microseconds
+    Histogram stretcher_process_time_us{20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000};
+    // How long the stretcher takes to process its input, as a percentage of how long the stretched
+    // input lasts. Counts the time of all channels as if they were processed on one thread
+    Histogram stretcher_load_percent{5, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 150, 200};
+    // How long the audio output takes to copy out of the ring buffer, in microseconds
+    Histogram output_read_time_us{1, 2, 5, 10, 20, 50, 100, 200, 500};
+    // How long the worker thread takes to handle a notify from the audio output, in microseconds
+    Histogram notify_time_us{10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+    // How long it takes from a seek until the sound device has processed the first frame from the new position,
+    // in microseconds
+    Histogram seek_latency_us{1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000};
+    // How full the ring buffer is when the audio output reads from it, in percent
+    Histogram fill_percent{0, 10, 20, 30, 40, 50, 60, 70, 80, 90};
+
+    // How many times the output wanted more frames than there were in the ring buffer
+    std::atomic<quint64> underruns{0};
+    // The lowest fill level the output has seen
+    std::atomic<size_t> min_fill_frames{static_cast<size_t>(-1)};
+    std::atomic<size_t> capacity_frames{0};
+    // Time spent waiting for audio while playing
+    std::atomic<qint64> idle_time_us{0};
+};
@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include <QAudio>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+
+#include "AudioFile.h"
+#include "AudioOutputDevice.h"
+#include "AudioRenderer.h"
+#include "AudioSink.h"
+#include "AudioStats.h"
+#include "Interleave.h"
+#include "KaraokeContainer/MappedFile.h"
+
+namespace Benchmark
+{
+
+static QTextStream& Out()
+{
+    static QTextStream stream(stdout);
+    return stream;
+}
+
+static std::unique_ptr<KaraokeContainer::MappedFile> MapFile(const QString& path)
+{
+    std::unique_ptr<QFile> file = std::make_unique<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly))
+    {
+        Out() << "Couldn't open " << path << ": " << file->errorString() << "\n";
+        return nullptr;
+    }
+
+    return std::make_unique<KaraokeContainer::MappedFile>(std::move(file));
+}
+
+// Returns the time taken in milliseconds, or -1 on failure. The length of the audio is stored in duration
+static qint64 TimeDecode(const QString& path, int thread_count, std::chrono::microseconds* duration)
+{
+    std::unique_ptr<KaraokeContainer::MappedFile> file = MapFile(path);
+    if (!file)
+        return -1;
+
+    AudioFile audio_file;
+    audio_file.SetDecodeThreadCount(thread_count);
+    audio_file.SetCacheEnabled(false);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QString error = audio_file.Load(std::move(file));
+    if (!error.isEmpty())
+    {
+        Out() << path << ": " << error << "\n";
+        return -1;
+    }
+    audio_file.WaitForDecoding();
+    const qint64 elapsed_ms = timer.elapsed();
+
+    *duration = audio_file.GetDuration();
+    return elapsed_ms;
+}
+
+// Compares decoding with one thread against decoding with one thread per CPU core
+static int RunDecode(const QStringList& paths)
+{
+    if (paths.isEmpty())
+    {
+        Out() << "Usage: --benchmark decode <audio files...>\n";
+        return 1;
+    }
+
+    for (const QString& path : paths)
+    {
+        std::chrono::microseconds duration;
+        const qint64 serial_ms = TimeDecode(path, 1, &duration);
+        const qint64 parallel_ms = TimeDecode(path, 0, &duration);
+        if (serial_ms < 0 || parallel_ms < 0)
+            return 1;
+
+        Out() << path << " (" << std::chrono::duration_cast<std::chrono::seconds>(duration).count()
+              << " s of audio): " << serial_ms << " ms with 1 thread, "
+              << parallel_ms << " ms with " << QThread::idealThreadCount() << " threads\n";
+        Out().flush();
+    }
+
+    return 0;
+}
+
+// Measures the per-block cost of each interleaving kernel that this CPU supports
+static int RunInterleave()
+{
+    constexpr size_t BLOCK_FRAMES = 1024;
+    constexpr int ITERATIONS = 100000;
+
+    for (const size_t channels : {1, 2, 6})
+    {
+        std::vector<float> interleaved(BLOCK_FRAMES * channels, 0.5f);
+        std::vector<std::vector<float>> planar(channels, std::vector<float>(BLOCK_FRAMES));
+        std::vector<float*> planar_pointers;
+        for (std::vector<float>& channel : planar)
+            planar_pointers.push_back(channel.data());
+
+        for (const Interleave::Kernels& kernels : Interleave::GetAvailableKernels())
+        {
+            QElapsedTimer timer;
+            timer.start();
+            for (int i = 0; i < ITERATIONS; ++i)
+                kernels.deinterleave(interleaved.data(), BLOCK_FRAMES, planar_pointers.data(), channels);
+            const qint64 deinterleave_ns = timer.nsecsElapsed() / ITERATIONS;
+
+            timer.restart();
+            for (int i = 0; i < ITERATIONS; ++i)
+                kernels.interleave(planar_pointers.data(), BLOCK_FRAMES, interleaved.data(), channels);
+            const qint64 interleave_ns = timer.nsecsElapsed() / ITERATIONS;
+
+            Out() << channels << " channel(s), " << kernels.name << ": "
+                  << deinterleave_ns << " ns to deinterleave, "
+                  << interleave_ns << " ns to interleave " << BLOCK_FRAMES << " frames\n";
+            Out().flush();
+        }
+    }
+
+    return 0;
+}
+
+struct PlaybackResult
+{
+    qint64 output_frames;
+    qint64 elapsed_ns;
+    // How long it took to get each block of output frames, counting from when the sink asked for it
+    std::vector<qint64> block_latencies_ns;
+};
+
+// Plays the first part of the file at the given time ratio into a sink that consumes as fast as possible
+static PlaybackResult TimePlayback(AudioFile* audio_file, double time_ratio, qint64 input_frames)
+{
+    constexpr size_t BLOCK_FRAMES = 1024;
+    constexpr std::chrono::microseconds RING_BUFFER_DURATION(100000);
+
+    const QAudioFormat format = audio_file->GetPCMFormat();
+    const qint64 bytes_per_frame = format.bytesPerFrame();
+
+    AudioStats stats;
+    AudioRenderer renderer(audio_file, format.sampleRate(),
+                           static_cast<size_t>(format.framesForDuration(RING_BUFFER_DURATION.count())), &stats);
+    renderer.SetTimeRatio(time_ratio);
+
+    PlaybackResult result{0, 0, {}};
+    QElapsedTimer block_timer;
+    size_t block_frames = 0;
+    AudioOutputDevice device([&](char* data, qint64 max_size) {
+        if (block_frames == 0)
+            block_timer.start();
+
+        const size_t frames = renderer.Read(reinterpret_cast<float*>(data),
+                                            static_cast<size_t>(max_size / bytes_per_frame));
+        block_frames += frames;
+        if (block_frames >= BLOCK_FRAMES)
+        {
+            result.block_latencies_ns.push_back(block_timer.nsecsElapsed());
+            block_frames = 0;
+        }
+
+        return static_cast<qint64>(frames) * bytes_per_frame;
+    });
+    device.open(QIODevice::ReadOnly);
+
+    const std::chrono::microseconds block_duration(format.durationForFrames(BLOCK_FRAMES));
+    NullAudioSink sink(format, NullAudioSink::Timing::AsFastAsPossible, block_duration,
+                       std::chrono::duration_cast<std::chrono::milliseconds>(block_duration) * 10);
+
+    QEventLoop loop;
+    const auto check_if_done = [&] {
+        const qint64 output_frame = format.framesForDuration(sink.GetProcessedDuration().count());
+        if (renderer.IsFinished() || renderer.GetInputFrame(output_frame) >= input_frames)
+            loop.quit();
+    };
+    QObject::connect(&sink, &AudioSink::Notify, &loop, check_if_done);
+    QObject::connect(&sink, &AudioSink::StateChanged, &loop, check_if_done);
+
+    QElapsedTimer timer;
+    timer.start();
+    renderer.Start();
+    sink.Start(&device);
+    loop.exec();
+    result.elapsed_ns = timer.nsecsElapsed();
+    result.output_frames = format.framesForDuration(sink.GetProcessedDuration().count());
+    sink.Stop();
+    renderer.Stop();
+
+    return result;
+}
+
+// Measures the whole playback pipeline (stretching, ring buffer, output) without a sound device,
+// at each speed that can be picked in the playback widget
+static int RunPlayback(const QStringList& paths)
+{
+    constexpr std::chrono::seconds PLAYBACK_DURATION(30);
+
+    if (paths.isEmpty())
+    {
+        Out() << "Usage: --benchmark playback <audio files...>\n";
+        return 1;
+    }
+
+    for (const QString& path : paths)
+    {
+        std::unique_ptr<KaraokeContainer::MappedFile> file = MapFile(path);
+        if (!file)
+            return 1;
+
+        AudioFile audio_file;
+        const QString error = audio_file.Load(std::move(file));
+        if (!error.isEmpty())
+        {
+            Out() << path << ": " << error << "\n";
+            return 1;
+        }
+        audio_file.WaitForDecoding();
+
+        const qint64 input_frames = std::min(audio_file.GetFrameCount(),
+                                             audio_file.FramesForDuration(PLAYBACK_DURATION));
+        const int sample_rate = audio_file.GetPCMFormat().sampleRate();
+        Out() << path << ", first " << audio_file.DurationForFrames(input_frames).count() / 1000 << " ms:\n";
+
+        // The same steps as the speed slider, from 100% down to 10%
+        for (int step = 10; step >= 1; --step)
+        {
+            PlaybackResult result = TimePlayback(&audio_file, 1 / (step * 0.1), input_frames);
+
+            std::vector<qint64>& latencies = result.block_latencies_ns;
+            std::sort(latencies.begin(), latencies.end());
+            const auto percentile = [&latencies](size_t percent) {
+                return latencies.empty() ? 0 : latencies[(latencies.size() - 1) * percent / 100] / 1000;
+            };
+            const qint64 mean_us = latencies.empty() ? 0 :
+                    std::accumulate(latencies.begin(), latencies.end(), qint64(0)) / latencies.size() / 1000;
+
+            const double seconds = result.elapsed_ns / 1e9;
+            Out() << "  " << step * 10 << "% speed: "
+                  << qint64(result.output_frames / seconds) << " frames/s ("
+                  << result.output_frames / seconds / sample_rate << "x real time), block latency "
+                  << mean_us << " us mean, " << percentile(50) << " us median, "
+                  << percentile(99) << " us 99th percentile, " << percentile(100) << " us max\n";
+            Out().flush();
+        }
+    }
+
+    return 0;
+}
+
+// The seek benchmark fails if the 99th percentile of the seek latency is above this. Enough for the
+// output buffer, the first block from a freshly reset stretcher and a few notify intervals
+static constexpr std::chrono::milliseconds SEEK_LATENCY_LIMIT(100);
+
+// Seeks around the file while playing to the default sound device, like the player does, or in real
+// time into a null sink if there is none. Returns how long it took from each seek until the device
+// had processed audio from the new position. Sets passed to whether every seek was heard within
+// SEEK_LATENCY_LIMIT, at the 99th percentile
+static QString TimeSeeks(AudioFile* audio_file, double time_ratio, bool* passed)
+{
+    constexpr int SEEK_COUNT = 20;
+    constexpr std::chrono::milliseconds SEEK_INTERVAL(200);
+    constexpr std::chrono::microseconds RING_BUFFER_DURATION(100000);
+    constexpr std::chrono::microseconds OUTPUT_BUFFER_DURATION(50000);
+    constexpr std::chrono::milliseconds NOTIFY_INTERVAL(10);
+
+    const QAudioFormat format = AudioSink::GetNativeFormat(audio_file->GetPCMFormat());
+    const qint64 bytes_per_frame = format.bytesPerFrame();
+
+    AudioStats stats;
+    AudioRenderer renderer(audio_file, format.sampleRate(),
+                           static_cast<size_t>(format.framesForDuration(RING_BUFFER_DURATION.count())), &stats);
+    renderer.SetTimeRatio(time_ratio);
+
+    AudioOutputDevice device([&](char* data, qint64 max_size) {
+        const size_t frames = renderer.Read(reinterpret_cast<float*>(data),
+                                            static_cast<size_t>(max_size / bytes_per_frame));
+        return static_cast<qint64>(frames) * bytes_per_frame;
+    });
+    device.open(QIODevice::ReadOnly);
+
+    std::unique_ptr<AudioSink> sink = AudioSink::Create(format, OUTPUT_BUFFER_DURATION, NOTIFY_INTERVAL);
+    QObject::connect(sink.get(), &AudioSink::Notify, [&] {
+        renderer.RecordProcessedFrames(format.framesForDuration(sink->GetProcessedDuration().count()));
+    });
+
+    QEventLoop loop;
+    QTimer timer;
+    int seeks = 0;
+    QObject::connect(&timer, &QTimer::timeout, &loop, [&] {
+        if (seeks == SEEK_COUNT)
+        {
+            loop.quit();
+            return;
+        }
+
+        // Jump all over the file, so that a seek never lands where playback already is
+        renderer.Seek(audio_file->GetFrameCount() * ((seeks * 7) % SEEK_COUNT) / SEEK_COUNT);
+        sink->Flush();
+        ++seeks;
+    });
+
+    renderer.Start();
+    sink->Start(&device);
+    timer.start(static_cast<int>(SEEK_INTERVAL.count()));
+    loop.exec();
+    sink->Stop();
+    renderer.Stop();
+
+    const qint64 limit_us = std::chrono::duration_cast<std::chrono::microseconds>(SEEK_LATENCY_LIMIT).count();
+    const qint64 p99_us = stats.seek_latency_us.GetPercentile(99);
+    *passed = stats.seek_latency_us.GetCount() >= static_cast<quint64>(SEEK_COUNT) && p99_us <= limit_us;
+
+    QString result = stats.seek_latency_us.Format(QStringLiteral("us"));
+    if (!*passed)
+    {
+        result += QStringLiteral("  FAILED: %1 of %2 seeks heard, 99th percentile %3 us, limit %4 us\n")
+                  .arg(stats.seek_latency_us.GetCount()).arg(SEEK_COUNT).arg(p99_us).arg(limit_us);
+    }
+    return result;
+}
+
+// Measures how long it takes for a seek to be heard, with and without the stretcher.
+// Exits with 1 if any of them is slower than SEEK_LATENCY_LIMIT
+static int RunSeek(const QStringList& paths)
+{
+    if (paths.isEmpty())
+    {
+        Out() << "Usage: --benchmark seek <audio files...>\n";
+        return 1;
+    }
+
+    bool all_passed = true;
+    for (const QString& path : paths)
+    {
+        std::unique_ptr<KaraokeContainer::MappedFile> file = MapFile(path);
+        if (!file)
+            return 1;
+
+        AudioFile audio_file;
+        const QString error = audio_file.Load(std::move(file));
+        if (!error.isEmpty())
+        {
+            Out() << path << ": " << error << "\n";
+            return 1;
+        }
+        audio_file.WaitForDecoding();
+
+        Out() << path << ":\n";
+        for (const int percent : {100, 50})
+        {
+            bool passed;
+            Out() << "  " << percent << "% speed:\n" << TimeSeeks(&audio_file, 100.0 / percent, &passed);
+            Out().flush();
+            all_passed = all_passed && passed;
+        }
+    }
+
+    return all_passed ? 0 : 1;
+}
+
+int Run(const QStringList& arguments)
+{
+    const QString mode = arguments.value(0);
+    const QStringList mode_arguments = arguments.mid(1);
+
+    if (mode == QStringLiteral("decode"))
+        return RunDecode(mode_arguments);
+    if (mode == QStringLiteral("interleave"))
+        return RunInterleave();
+    if (mode == QStringLiteral("playback"))
+        return RunPlayback(mode_arguments);
+    if (mode == QStringLiteral("seek"))
+        return RunSeek(mode_arguments);
+
+    Out() << "Unknown benchmark \"" << mode << "\". Available benchmarks: decode, interleave, playback, seek\n";
+    return 1;
+}
+
+}
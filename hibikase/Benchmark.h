@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <QStringList>
+
+// Command line benchmarks, run with: hibikase --benchmark <mode> [arguments...]
+namespace Benchmark
+{
+
+// Returns the exit code of the program
+int Run(const QStringList& arguments);
+
+}
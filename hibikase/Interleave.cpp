@@ -0,0 +1,404 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "Interleave.h"
+
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INTERLEAVE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define INTERLEAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(INTERLEAVE_X86) || defined(INTERLEAVE_NEON)
+#define INTERLEAVE_SIMD
+#endif
+
+namespace Interleave
+{
+
+static void DeinterleaveScalar(const float* in, size_t frames, float* const* out, size_t channels)
+{
+    if (channels == 1)
+    {
+        std::memcpy(out[0], in, frames * sizeof(float));
+        return;
+    }
+
+    for (size_t i = 0; i < channels; ++i)
+    {
+        const float* ptr = in + i;
+        float* dest = out[i];
+        for (size_t j = 0; j < frames; ++j)
+        {
+            dest[j] = *ptr;
+            ptr += channels;
+        }
+    }
+}
+
+static void InterleaveScalar(const float* const* in, size_t frames, float* out, size_t channels)
+{
+    if (channels == 1)
+    {
+        std::memcpy(out, in[0], frames * sizeof(float));
+        return;
+    }
+
+    for (size_t i = 0; i < channels; ++i)
+    {
+        const float* src = in[i];
+        float* ptr = out + i;
+        for (size_t j = 0; j < frames; ++j)
+        {
+            *ptr = src[j];
+            ptr += channels;
+        }
+    }
+}
+
+#ifdef INTERLEAVE_SIMD
+
+// The SIMD kernels process as many frames as they can in whole vectors and leave the rest
+// to the scalar code below. With four or more channels, each group of four channels is
+// transposed four frames at a time, and the channels left over after the last whole group
+// are done by the scalar code as well.
+
+static void DeinterleaveStereoTail(const float* in, size_t start, size_t frames, float* const* out)
+{
+    for (size_t j = start; j < frames; ++j)
+    {
+        out[0][j] = in[j * 2];
+        out[1][j] = in[j * 2 + 1];
+    }
+}
+
+static void InterleaveStereoTail(const float* const* in, size_t start, size_t frames, float* out)
+{
+    for (size_t j = start; j < frames; ++j)
+    {
+        out[j * 2] = in[0][j];
+        out[j * 2 + 1] = in[1][j];
+    }
+}
+
+// Handles the channels from first_channel onwards for the frames before start,
+// and all channels for the frames from start onwards
+static void DeinterleaveMultiTail(const float* in, size_t start, size_t frames, float* const* out,
+                                  size_t channels, size_t first_channel)
+{
+    for (size_t i = first_channel; i < channels; ++i)
+    {
+        for (size_t j = 0; j < start; ++j)
+            out[i][j] = in[j * channels + i];
+    }
+    for (size_t j = start; j < frames; ++j)
+    {
+        for (size_t i = 0; i < channels; ++i)
+            out[i][j] = in[j * channels + i];
+    }
+}
+
+static void InterleaveMultiTail(const float* const* in, size_t start, size_t frames, float* out,
+                                size_t channels, size_t first_channel)
+{
+    for (size_t i = first_channel; i < channels; ++i)
+    {
+        for (size_t j = 0; j < start; ++j)
+            out[j * channels + i] = in[i][j];
+    }
+    for (size_t j = start; j < frames; ++j)
+    {
+        for (size_t i = 0; i < channels; ++i)
+            out[j * channels + i] = in[i][j];
+    }
+}
+
+#endif
+
+#ifdef INTERLEAVE_X86
+
+static void DeinterleaveMultiSSE2(const float* in, size_t frames, float* const* out, size_t channels)
+{
+    const size_t vector_channels = channels - channels % 4;
+    size_t j = 0;
+    for (; j + 4 <= frames; j += 4)
+    {
+        for (size_t i = 0; i < vector_channels; i += 4)
+        {
+            // One row per frame, which the transpose turns into one row per channel
+            __m128 row0 = _mm_loadu_ps(in + j * channels + i);
+            __m128 row1 = _mm_loadu_ps(in + (j + 1) * channels + i);
+            __m128 row2 = _mm_loadu_ps(in + (j + 2) * channels + i);
+            __m128 row3 = _mm_loadu_ps(in + (j + 3) * channels + i);
+            _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+            _mm_storeu_ps(out[i] + j, row0);
+            _mm_storeu_ps(out[i + 1] + j, row1);
+            _mm_storeu_ps(out[i + 2] + j, row2);
+            _mm_storeu_ps(out[i + 3] + j, row3);
+        }
+    }
+    DeinterleaveMultiTail(in, j, frames, out, channels, vector_channels);
+}
+
+static void InterleaveMultiSSE2(const float* const* in, size_t frames, float* out, size_t channels)
+{
+    const size_t vector_channels = channels - channels % 4;
+    size_t j = 0;
+    for (; j + 4 <= frames; j += 4)
+    {
+        for (size_t i = 0; i < vector_channels; i += 4)
+        {
+            __m128 row0 = _mm_loadu_ps(in[i] + j);
+            __m128 row1 = _mm_loadu_ps(in[i + 1] + j);
+            __m128 row2 = _mm_loadu_ps(in[i + 2] + j);
+            __m128 row3 = _mm_loadu_ps(in[i + 3] + j);
+            _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+            _mm_storeu_ps(out + j * channels + i, row0);
+            _mm_storeu_ps(out + (j + 1) * channels + i, row1);
+            _mm_storeu_ps(out + (j + 2) * channels + i, row2);
+            _mm_storeu_ps(out + (j + 3) * channels + i, row3);
+        }
+    }
+    InterleaveMultiTail(in, j, frames, out, channels, vector_channels);
+}
+
+static void DeinterleaveSSE2(const float* in, size_t frames, float* const* out, size_t channels)
+{
+    if (channels >= 4)
+        return DeinterleaveMultiSSE2(in, frames, out, channels);
+    if (channels != 2)
+        return DeinterleaveScalar(in, frames, out, channels);
+
+    size_t j = 0;
+    for (; j + 4 <= frames; j += 4)
+    {
+        const __m128 a = _mm_loadu_ps(in + j * 2);      // L0 R0 L1 R1
+        const __m128 b = _mm_loadu_ps(in + j * 2 + 4);  // L2 R2 L3 R3
+        _mm_storeu_ps(out[0] + j, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(out[1] + j, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    DeinterleaveStereoTail(in, j, frames, out);
+}
+
+static void InterleaveSSE2(const float* const* in, size_t frames, float* out, size_t channels)
+{
+    if (channels >= 4)
+        return InterleaveMultiSSE2(in, frames, out, channels);
+    if (channels != 2)
+        return InterleaveScalar(in, frames, out, channels);
+
+    size_t j = 0;
+    for (; j + 4 <= frames; j += 4)
+    {
+        const __m128 left = _mm_loadu_ps(in[0] + j);
+        const __m128 right = _mm_loadu_ps(in[1] + j);
+        _mm_storeu_ps(out + j * 2, _mm_unpacklo_ps(left, right));
+        _mm_storeu_ps(out + j * 2 + 4, _mm_unpackhi_ps(left, right));
+    }
+    InterleaveStereoTail(in, j, frames, out);
+}
+
+// With more than two channels, the SSE2 code is used, since the loads and stores of
+// a wider transpose would be split across frames anyway
+
+TARGET_AVX2 static void DeinterleaveAVX2(const float* in, size_t frames, float* const* out, size_t channels)
+{
+    if (channels != 2)
+        return DeinterleaveSSE2(in, frames, out, channels);
+
+    size_t j = 0;
+    for (; j + 8 <= frames; j += 8)
+    {
+        const __m256 a = _mm256_loadu_ps(in + j * 2);      // L0 R0 L1 R1 | L2 R2 L3 R3
+        const __m256 b = _mm256_loadu_ps(in + j * 2 + 8);  // L4 R4 L5 R5 | L6 R6 L7 R7
+        // L0 L1 L4 L5 | L2 L3 L6 L7, which the permute puts back in order
+        const __m256 left = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m256 right = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm256_storeu_ps(out[0] + j, _mm256_castpd_ps(
+                _mm256_permute4x64_pd(_mm256_castps_pd(left), _MM_SHUFFLE(3, 1, 2, 0))));
+        _mm256_storeu_ps(out[1] + j, _mm256_castpd_ps(
+                _mm256_permute4x64_pd(_mm256_castps_pd(right), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    DeinterleaveStereoTail(in, j, frames, out);
+}
+
+TARGET_AVX2 static void InterleaveAVX2(const float* const* in, size_t frames, float* out, size_t channels)
+{
+    if (channels != 2)
+        return InterleaveSSE2(in, frames, out, channels);
+
+    size_t j = 0;
+    for (; j + 8 <= frames; j += 8)
+    {
+        const __m256 left = _mm256_loadu_ps(in[0] + j);
+        const __m256 right = _mm256_loadu_ps(in[1] + j);
+        const __m256 low = _mm256_unpacklo_ps(left, right);   // L0 R0 L1 R1 | L4 R4 L5 R5
+        const __m256 high = _mm256_unpackhi_ps(left, right);  // L2 R2 L3 R3 | L6 R6 L7 R7
+        _mm256_storeu_ps(out + j * 2, _mm256_permute2f128_ps(low, high, 0x20));
+        _mm256_storeu_ps(out + j * 2 + 8, _mm256_permute2f128_ps(low, high, 0x31));
+    }
+    InterleaveStereoTail(in, j, frames, out);
+}
+
+static bool CPUSupportsAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // The OS must also save the AVX registers on context switches
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+#ifdef INTERLEAVE_NEON
+
+// Turns four rows of four into four columns of four
+static void TransposeNEON(float32x4_t* row0, float32x4_t* row1, float32x4_t* row2, float32x4_t* row3)
+{
+    const float32x4x2_t low = vtrnq_f32(*row0, *row1);   // a0 b0 a2 b2, a1 b1 a3 b3
+    const float32x4x2_t high = vtrnq_f32(*row2, *row3);  // c0 d0 c2 d2, c1 d1 c3 d3
+    *row0 = vcombine_f32(vget_low_f32(low.val[0]), vget_low_f32(high.val[0]));
+    *row1 = vcombine_f32(vget_low_f32(low.val[1]), vget_low_f32(high.val[1]));
+    *row2 = vcombine_f32(vget_high_f32(low.val[0]), vget_high_f32(high.val[0]));
+    *row3 = vcombine_f32(vget_high_f32(low.val[1]), vget_high_f32(high.val[1]));
+}
+
+static void DeinterleaveMultiNEON(const float* in, size_t frames, float* const* out, size_t channels)
+{
+    const size_t vector_channels = channels - channels % 4;
+    size_t j = 0;
+    for (; j + 4 <= frames; j += 4)
+    {
+        for (size_t i = 0; i < vector_channels; i += 4)
+        {
+            float32x4_t row0 = vld1q_f32(in + j * channels + i);
+            float32x4_t row1 = vld1q_f32(in + (j + 1) * channels + i);
+            float32x4_t row2 = vld1q_f32(in + (j + 2) * channels + i);
+            float32x4_t row3 = vld1q_f32(in + (j + 3) * channels + i);
+            TransposeNEON(&row0, &row1, &row2, &row3);
+            vst1q_f32(out[i] + j, row0);
+            vst1q_f32(out[i + 1] + j, row1);
+            vst1q_f32(out[i + 2] + j, row2);
+            vst1q_f32(out[i + 3] + j, row3);
+        }
+    }
+    DeinterleaveMultiTail(in, j, frames, out, channels, vector_channels);
+}
+
+static void InterleaveMultiNEON(const float* const* in, size_t frames, float* out, size_t channels)
+{
+    const size_t vector_channels = channels - channels % 4;
+    size_t j = 0;
+    for (; j + 4 <= frames; j += 4)
+    {
+        for (size_t i = 0; i < vector_channels; i += 4)
+        {
+            float32x4_t row0 = vld1q_f32(in[i] + j);
+            float32x4_t row1 = vld1q_f32(in[i + 1] + j);
+            float32x4_t row2 = vld1q_f32(in[i + 2] + j);
+            float32x4_t row3 = vld1q_f32(in[i + 3] + j);
+            TransposeNEON(&row0, &row1, &row2, &row3);
+            vst1q_f32(out + j * channels + i, row0);
+            vst1q_f32(out + (j + 1) * channels + i, row1);
+            vst1q_f32(out + (j + 2) * channels + i, row2);
+            vst1q_f32(out + (j + 3) * channels + i, row3);
+        }
+    }
+    InterleaveMultiTail(in, j, frames, out, channels, vector_channels);
+}
+
+static void DeinterleaveNEON(const float* in, size_t frames, float* const* out, size_t channels)
+{
+    if (channels >= 4)
+        return DeinterleaveMultiNEON(in, frames, out, channels);
+    if (channels != 2)
+        return DeinterleaveScalar(in, frames, out, channels);
+
+    size_t j = 0;
+    for (; j + 4 <= frames; j += 4)
+    {
+        const float32x4x2_t samples = vld2q_f32(in + j * 2);
+        vst1q_f32(out[0] + j, samples.val[0]);
+        vst1q_f32(out[1] + j, samples.val[1]);
+    }
+    DeinterleaveStereoTail(in, j, frames, out);
+}
+
+static void InterleaveNEON(const float* const* in, size_t frames, float* out, size_t channels)
+{
+    if (channels >= 4)
+        return InterleaveMultiNEON(in, frames, out, channels);
+    if (channels != 2)
+        return InterleaveScalar(in, frames, out, channels);
+
+    size_t j = 0;
+    for (; j + 4 <= frames; j += 4)
+    {
+        float32x4x2_t samples;
+        samples.val[0] = vld1q_f32(in[0] + j);
+        samples.val[1] = vld1q_f32(in[1] + j);
+        vst2q_f32(out + j * 2, samples);
+    }
+    InterleaveStereoTail(in, j, frames, out);
+}
+
+#endif
+
+const std::vector<Kernels>& GetAvailableKernels()
+{
+    static const std::vector<Kernels> kernels = [] {
+        std::vector<Kernels> result{{"scalar", DeinterleaveScalar, InterleaveScalar}};
+#ifdef INTERLEAVE_X86
+        result.push_back({"SSE2", DeinterleaveSSE2, InterleaveSSE2});
+        if (CPUSupportsAVX2())
+            result.push_back({"AVX2", DeinterleaveAVX2, InterleaveAVX2});
+#endif
+#ifdef INTERLEAVE_NEON
+        result.push_back({"NEON", DeinterleaveNEON, InterleaveNEON});
+#endif
+        return result;
+    }();
+
+    return kernels;
+}
+
+static const Kernels& GetBestKernels()
+{
+    static const Kernels& best = GetAvailableKernels().back();
+    return best;
+}
+
+void Deinterleave(const float* in, size_t frames, float* const* out, size_t channels)
+{
+    GetBestKernels().deinterleave(in, frames, out, channels);
+}
+
+void Interleave(const float* const* in, size_t frames, float* out, size_t channels)
+{
+    GetBestKernels().interleave(in, frames, out, channels);
+}
+
+}
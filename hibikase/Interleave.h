@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Conversion between interleaved float samples (as used by the decoders and
+// the audio output) and one array per channel (as used by the PCM store and
+// the stretcher). Mono is a plain copy, which memcpy already vectorizes. Stereo and
+// four or more channels have SIMD implementations, and the fastest one the CPU
+// supports gets picked at runtime. Three channels use scalar code.
+namespace Interleave
+{
+
+using DeinterleaveFunction = void (*)(const float* in, size_t frames, float* const* out, size_t channels);
+using InterleaveFunction = void (*)(const float* const* in, size_t frames, float* out, size_t channels);
+
+struct Kernels
+{
+    const char* name;
+    DeinterleaveFunction deinterleave;
+    InterleaveFunction interleave;
+};
+
+// Ordered from slowest to fastest. Only contains kernels that this CPU supports
+const std::vector<Kernels>& GetAvailableKernels();
+
+// Splits channels-interleaved samples into out[0], out[1], ..., out[channels - 1]
+void Deinterleave(const float* in, size_t frames, float* const* out, size_t channels);
+// The reverse of Deinterleave
+void Interleave(const float* const* in, size_t frames, float* out, size_t channels);
+
+}
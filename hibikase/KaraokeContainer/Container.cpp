@@ -1,15 +1,26 @@
 // SPDX-License-Identifier: GPL-2.0-or-later OR CC0-1.0
 
 #include <memory>
+#include <utility>
 
+#include <QIODevice>
 #include <QString>
 
 #include "KaraokeContainer/Container.h"
+#include "KaraokeContainer/MappedFile.h"
 #include "KaraokeContainer/PlainContainer.h"
 
 namespace KaraokeContainer
 {
 
+std::unique_ptr<MappedFile> Container::MapAudioFile() const
+{
+    std::unique_ptr<QIODevice> device = ReadAudioFile();
+    if (!device)
+        return nullptr;
+    return std::make_unique<MappedFile>(std::move(device));
+}
+
 std::unique_ptr<Container> Load(const QString& path)
 {
     return std::make_unique<PlainContainer>(path);
@@ -8,6 +8,8 @@
 #include <QIODevice>
 #include <QString>
 
+#include "KaraokeContainer/MappedFile.h"
+
 namespace KaraokeContainer
 {
 
@@ -18,6 +20,8 @@ public:
 
     // Returns a read-only QIODevice that already is open, or nullptr
     virtual std::unique_ptr<QIODevice> ReadAudioFile() const = 0;
+    // Like ReadAudioFile, but gives direct access to the bytes (memory-mapped if possible)
+    virtual std::unique_ptr<MappedFile> MapAudioFile() const;
 
     virtual QByteArray ReadLyricsFile() const = 0;
     virtual bool SaveLyricsFile(const QByteArray& content) const = 0;
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR CC0-1.0
+
+#include <memory>
+#include <utility>
+
+#include <QByteArray>
+#include <QDebug>
+#include <QFileDevice>
+#include <QFileInfo>
+#include <QIODevice>
+
+#include "KaraokeContainer/MappedFile.h"
+
+namespace KaraokeContainer
+{
+
+MappedFile::MappedFile(std::unique_ptr<QIODevice> device)
+    : m_device(std::move(device))
+{
+    if (QFileDevice* file = qobject_cast<QFileDevice*>(m_device.get()))
+    {
+        const QFileInfo file_info(file->fileName());
+        m_last_modified = file_info.lastModified();
+        m_file_path = file_info.absoluteFilePath();
+
+        const qint64 size = file->size();
+        if (size > 0)
+            m_data = file->map(0, size);
+
+        if (m_data)
+        {
+            m_size = size;
+            return;
+        }
+
+        qInfo() << "Couldn't memory-map file, reading it instead:" << file->errorString();
+    }
+
+    m_fallback_data = m_device->readAll();
+    m_device->close();
+    m_device.reset();
+
+    m_data = reinterpret_cast<const uchar*>(m_fallback_data.constData());
+    m_size = m_fallback_data.size();
+}
+
+// The mapping (if any) is removed when m_device is closed
+MappedFile::~MappedFile() = default;
+
+}
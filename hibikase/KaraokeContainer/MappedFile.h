@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR CC0-1.0
+
+#pragma once
+
+#include <memory>
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QIODevice>
+#include <QString>
+
+namespace KaraokeContainer
+{
+
+// A read-only view of the full contents of a file. If the file is backed by
+// the file system, it gets memory-mapped instead of being read onto the heap.
+class MappedFile final
+{
+public:
+    // Takes a QIODevice that already is open
+    explicit MappedFile(std::unique_ptr<QIODevice> device);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uchar* GetData() const { return m_data; }
+    qint64 GetSize() const { return m_size; }
+    // Invalid if the file isn't backed by the file system
+    QDateTime GetLastModified() const { return m_last_modified; }
+    // The absolute path, or empty if the file isn't backed by the file system
+    QString GetFilePath() const { return m_file_path; }
+
+private:
+    std::unique_ptr<QIODevice> m_device;
+    QByteArray m_fallback_data;
+    const uchar* m_data = nullptr;
+    qint64 m_size = 0;
+    QDateTime m_last_modified;
+    QString m_file_path;
+};
+
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0-or-later OR CC0-1.0
+
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace KaraokeData
+{
+
+// A list of non-negative numbers that can both be changed and summed up
+// in O(log n). Assign is O(n).
+class FenwickTree final
+{
+public:
+    size_t GetSize() const { return m_values.size(); }
+    int Get(size_t index) const { return m_values[index]; }
+
+    void Assign(std::vector<int> values)
+    {
+        m_values = std::move(values);
+        m_tree.assign(m_values.size() + 1, 0);
+        for (size_t i = 1; i < m_tree.size(); ++i)
+        {
+            m_tree[i] += m_values[i - 1];
+            const size_t parent = i + (i & (~i + 1));
+            if (parent < m_tree.size())
+                m_tree[parent] += m_tree[i];
+        }
+
+        m_highest_step = 1;
+        while (m_highest_step * 2 <= m_values.size())
+            m_highest_step *= 2;
+    }
+
+    void Set(size_t index, int value)
+    {
+        const int delta = value - m_values[index];
+        m_values[index] = value;
+        for (size_t i = index + 1; i < m_tree.size(); i += i & (~i + 1))
+            m_tree[i] += delta;
+    }
+
+    // The sum of the first count numbers
+    int PrefixSum(size_t count) const
+    {
+        int sum = 0;
+        for (size_t i = count; i > 0; i -= i & (~i + 1))
+            sum += m_tree[i];
+        return sum;
+    }
+
+    // The highest count for which PrefixSum(count) <= sum
+    size_t UpperBound(int sum) const
+    {
+        size_t count = 0;
+        for (size_t step = m_highest_step; step > 0 && !m_values.empty(); step /= 2)
+        {
+            if (count + step < m_tree.size() && m_tree[count + step] <= sum)
+            {
+                count += step;
+                sum -= m_tree[count];
+            }
+        }
+        return count;
+    }
+
+private:
+    std::vector<int> m_values;
+    // m_tree[i] is the sum of the m_values ending at index i - 1, as many as the lowest set bit of i
+    std::vector<int> m_tree;
+    size_t m_highest_step = 1;
+};
+
+}
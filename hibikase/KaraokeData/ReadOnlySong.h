@@ -27,8 +27,6 @@ namespace KaraokeData
 
 class ReadOnlySyllable final : public Syllable
 {
-    Q_OBJECT
-
 public:
     // Note: This default constructor won't initialize class members properly
     ReadOnlySyllable() {}
@@ -37,10 +37,10 @@ static constexpr Centiseconds PLACEHOLDER_TIME = Centiseconds(100 * 60 * 100 - 1
 static constexpr Centiseconds MAXIMUM_TIME = PLACEHOLDER_TIME - Centiseconds(1);
 static constexpr Centiseconds MINIMUM_TIME = Centiseconds(0);
 
-class Syllable : public QObject
+// Not a QObject, since songs can have tens of thousands of syllables.
+// Changes to a syllable are reported by the line it belongs to
+class Syllable
 {
-    Q_OBJECT
-
 public:
     virtual ~Syllable() = default;
 
@@ -21,31 +21,46 @@ namespace KaraokeData
 {
 
 static const QString PLACEHOLDER_TIMECODE = QStringLiteral("[99:59:99]");
+static constexpr int TIMECODE_LENGTH = 10;
 
 // TODO: The user might want LF instead of CRLF
 static const QString LINE_ENDING = "\r\n";
 
-SoramimiSyllable::SoramimiSyllable(const QString& text, Centiseconds start, Centiseconds end)
-    : m_text(text), m_start(start), m_end(end)
+QString SoramimiSyllable::GetText() const
 {
+    const std::vector<int>& offsets = m_line->m_syllable_text_offsets;
+    return m_line->m_syllable_texts.mid(offsets[m_index], offsets[m_index + 1] - offsets[m_index]);
 }
 
 void SoramimiSyllable::SetText(const QString& text)
 {
-    m_text = text;
-    emit Changed();
+    std::vector<int>& offsets = m_line->m_syllable_text_offsets;
+    const int old_size = offsets[m_index + 1] - offsets[m_index];
+    m_line->m_syllable_texts.replace(offsets[m_index], old_size, text);
+    for (size_t i = m_index + 1; i < offsets.size(); ++i)
+        offsets[i] += text.size() - old_size;
+
+    m_line->OnSyllableChanged();
+}
+
+Centiseconds SoramimiSyllable::GetStart() const
+{
+    return m_line->m_syllable_starts[m_index];
 }
 
 void SoramimiSyllable::SetStart(Centiseconds time)
 {
-    m_start = time;
-    emit Changed();
+    m_line->SetSyllableTime(m_index, time, false);
+}
+
+Centiseconds SoramimiSyllable::GetEnd() const
+{
+    return m_line->m_syllable_ends[m_index];
 }
 
 void SoramimiSyllable::SetEnd(Centiseconds time)
 {
-    m_end = time;
-    emit Changed();
+    m_line->SetSyllableTime(m_index, time, true);
 }
 
 SoramimiLine::SoramimiLine(const QString& content)
@@ -67,8 +82,8 @@ QVector<Syllable*> SoramimiLine::GetSyllables()
 {
     QVector<Syllable*> result{};
     result.reserve(m_syllables.size());
-    for (std::unique_ptr<SoramimiSyllable>& syllable : m_syllables)
-        result.push_back(syllable.get());
+    for (SoramimiSyllable& syllable : m_syllables)
+        result.push_back(&syllable);
     return result;
 }
 
@@ -76,8 +91,8 @@ QVector<const Syllable*> SoramimiLine::GetSyllables() const
 {
     QVector<const Syllable*> result{};
     result.reserve(m_syllables.size());
-    for (const std::unique_ptr<SoramimiSyllable>& syllable : m_syllables)
-        result.push_back(syllable.get());
+    for (const SoramimiSyllable& syllable : m_syllables)
+        result.push_back(&syllable);
     return result;
 }
 
@@ -112,7 +127,8 @@ int SoramimiLine::PositionFromRaw(int raw_position) const
     int current_position = m_prefix.size();
     for (; syllable_number < m_raw_syllable_positions.size(); ++syllable_number)
     {
-        const int syllable_size = m_syllables[syllable_number]->GetText().size();
+        const int syllable_size = m_syllable_text_offsets[syllable_number + 1] -
+                                  m_syllable_text_offsets[syllable_number];
         const int raw_syllable_position = m_raw_syllable_positions[syllable_number];
 
         if (raw_position <= raw_syllable_position + syllable_size)
@@ -130,17 +146,15 @@ int SoramimiLine::PositionToRaw(int position) const
     if (position <= m_prefix.size())
         return position;
 
-    size_t syllable_number = 0;
     int current_position = m_prefix.size();
-    for (const std::unique_ptr<SoramimiSyllable>& syllable : m_syllables)
+    for (size_t syllable_number = 0; syllable_number < m_syllables.size(); ++syllable_number)
     {
         if (position <= current_position)
         {
             const int position_in_syllable = std::max(0, position - current_position);
             return m_raw_syllable_positions[syllable_number] + position_in_syllable;
         }
-        syllable_number++;
-        current_position += syllable->GetText().size();
+        current_position += m_syllable_text_offsets[syllable_number + 1] - m_syllable_text_offsets[syllable_number];
     }
     return current_position;
 }
@@ -155,6 +169,8 @@ void SoramimiLine::Serialize(const QVector<const Syllable*>& syllables)
 {
     m_raw_content.clear();
     m_raw_syllable_positions.clear();
+    m_raw_start_timecode_positions.clear();
+    m_raw_end_timecode_positions.clear();
 
     m_raw_content += m_prefix;
 
@@ -173,27 +189,45 @@ void SoramimiLine::Serialize(const QVector<const Syllable*>& syllables)
                 // Karaoke Tools doesn't handle adjacent timecodes perfectly.
                 m_raw_content.remove(last_character_of_previous_text, 1);
                 m_raw_content += ' ';
+                if (!m_raw_end_timecode_positions.empty())
+                    m_raw_end_timecode_positions.back()--;
             }
+            m_raw_start_timecode_positions.push_back(m_raw_content.size());
             m_raw_content += SerializeTime(start);
         }
+        else
+        {
+            // The end timecode of the previous syllable doubles as the start timecode of this one
+            m_raw_start_timecode_positions.push_back(m_raw_end_timecode_positions.back());
+        }
 
         m_raw_syllable_positions.push_back(m_raw_content.size());
         m_raw_content += syllable->GetText();
         last_character_of_previous_text = m_raw_content.size() - 1;
 
         Centiseconds end = syllable->GetEnd();
+        m_raw_end_timecode_positions.push_back(m_raw_content.size());
         m_raw_content += SerializeTime(end);
         previous_time = end;
     }
 
     if (m_raw_content.endsWith(PLACEHOLDER_TIMECODE))
+    {
         m_raw_content.chop(PLACEHOLDER_TIMECODE.size());
+        m_raw_end_timecode_positions.back() = -1;
+    }
 }
 
 void SoramimiLine::Deserialize()
 {
     m_syllables.clear();
+    m_syllable_texts.clear();
+    m_syllable_text_offsets.assign(1, 0);
+    m_syllable_starts.clear();
+    m_syllable_ends.clear();
     m_raw_syllable_positions.clear();
+    m_raw_start_timecode_positions.clear();
+    m_raw_end_timecode_positions.clear();
     m_prefix.clear();
 
     bool first_timecode = true;
@@ -248,6 +282,10 @@ void SoramimiLine::Deserialize()
     else
         AddSyllable(previous_index, m_raw_content.size(), previous_time, PLACEHOLDER_TIME);
 
+    m_syllables.reserve(m_syllable_starts.size());
+    for (size_t i = 0; i < m_syllable_starts.size(); ++i)
+        m_syllables.emplace_back(this, i);
+
     CalculateStartAndEnd();
 }
 
@@ -256,12 +294,15 @@ void SoramimiLine::CalculateStartAndEnd()
     m_start = Centiseconds::max();
     m_end = Centiseconds::min();
 
-    for (const std::unique_ptr<SoramimiSyllable>& syllable : m_syllables)
+    for (const Centiseconds start : m_syllable_starts)
     {
-        if (syllable->GetStart() != PLACEHOLDER_TIME)
-            m_start = std::min(syllable->GetStart(), m_start);
-        if (syllable->GetEnd() != PLACEHOLDER_TIME)
-            m_end = std::max(syllable->GetEnd(), m_end);
+        if (start != PLACEHOLDER_TIME)
+            m_start = std::min(start, m_start);
+    }
+    for (const Centiseconds end : m_syllable_ends)
+    {
+        if (end != PLACEHOLDER_TIME)
+            m_end = std::max(end, m_end);
     }
 
     if (m_start == Centiseconds::max())
@@ -277,24 +318,88 @@ void SoramimiLine::AddSyllable(int start, int end,
     const bool empty = text.count(' ') == text.size();
     if (empty)
     {
-        if (!m_syllables.empty())
-            m_syllables.back()->m_text += text;
+        // Spaces between two timecodes go at the end of the previous syllable
+        if (!m_syllable_starts.empty())
+        {
+            m_syllable_texts += text;
+            m_syllable_text_offsets.back() = m_syllable_texts.size();
+        }
     }
     else
     {
         m_raw_syllable_positions.push_back(start);
-        m_syllables.emplace_back(std::make_unique<SoramimiSyllable>(
-                                 text.toString(), start_time, end_time));
-        connect(m_syllables.back().get(), &SoramimiSyllable::Changed, this, [this] {
-            const int old_raw_length = m_raw_content.size();
+        // Each piece of text is right between two timecodes, except at the end of the line
+        m_raw_start_timecode_positions.push_back(start - TIMECODE_LENGTH);
+        m_raw_end_timecode_positions.push_back(end < m_raw_content.size() ? end : -1);
+        m_syllable_texts += text;
+        m_syllable_text_offsets.push_back(m_syllable_texts.size());
+        m_syllable_starts.push_back(start_time);
+        m_syllable_ends.push_back(end_time);
+    }
+}
 
-            Serialize();
-            BuildText();
-            CalculateStartAndEnd();
+void SoramimiLine::SetSyllableTime(size_t syllable, Centiseconds time, bool is_end)
+{
+    std::vector<Centiseconds>& times = is_end ? m_syllable_ends : m_syllable_starts;
+    const Centiseconds old_time = times[syllable];
+    times[syllable] = time;
 
-            emit Changed(old_raw_length, m_raw_content.size());
-        });
+    if (!PatchTimecode(syllable, is_end))
+    {
+        OnSyllableChanged();
+        return;
     }
+
+    // The text hasn't changed, so only the start or end of the line may need updating
+    Centiseconds& line_time = is_end ? m_end : m_start;
+    const bool moved_inwards = is_end ? time < old_time : time > old_time;
+    if (old_time == line_time && (time == PLACEHOLDER_TIME || moved_inwards))
+        CalculateStartAndEnd();
+    else if (time != PLACEHOLDER_TIME)
+        line_time = is_end ? std::max(line_time, time) : std::min(line_time, time);
+
+    emit Changed(m_raw_content.size(), m_raw_content.size());
+}
+
+bool SoramimiLine::PatchTimecode(size_t syllable, bool is_end)
+{
+    const Centiseconds time = is_end ? m_syllable_ends[syllable] : m_syllable_starts[syllable];
+    const int position = is_end ? m_raw_end_timecode_positions[syllable] :
+                                  m_raw_start_timecode_positions[syllable];
+    if (position < 0)
+        return false;
+
+    // A timecode that is shared with the neighbouring syllable, or that is about to be,
+    // changes how the line is laid out
+    const bool has_neighbour = is_end ? syllable + 1 < m_syllable_starts.size() : syllable > 0;
+    if (has_neighbour)
+    {
+        const size_t neighbour = is_end ? syllable + 1 : syllable - 1;
+        const int neighbour_position = is_end ? m_raw_start_timecode_positions[neighbour] :
+                                                m_raw_end_timecode_positions[neighbour];
+        const Centiseconds neighbour_time = is_end ? m_syllable_starts[neighbour] : m_syllable_ends[neighbour];
+        if (neighbour_position == position || neighbour_time == time)
+            return false;
+    }
+    else if (is_end && time == PLACEHOLDER_TIME)
+    {
+        // A placeholder at the end of the line gets left out
+        return false;
+    }
+
+    m_raw_content.replace(position, TIMECODE_LENGTH, SerializeTime(time));
+    return true;
+}
+
+void SoramimiLine::OnSyllableChanged()
+{
+    const int old_raw_length = m_raw_content.size();
+
+    Serialize();
+    BuildText();
+    CalculateStartAndEnd();
+
+    emit Changed(old_raw_length, m_raw_content.size());
 }
 
 QString SoramimiLine::SerializeTime(Centiseconds time)
@@ -304,6 +409,18 @@ QString SoramimiLine::SerializeTime(Centiseconds time)
     Seconds seconds = std::chrono::duration_cast<Seconds>(time - minutes);
     Centiseconds centiseconds = time - minutes - seconds;
 
+    // The common case, without going through QString::arg
+    if (time.count() >= 0 && minutes.count() < 100)
+    {
+        const auto digit = [](int number) { return QChar('0' + number); };
+        const QChar timecode[TIMECODE_LENGTH] = {
+            '[', digit(minutes.count() / 10), digit(minutes.count() % 10),
+            ':', digit(seconds.count() / 10), digit(seconds.count() % 10),
+            ':', digit(centiseconds.count() / 10), digit(centiseconds.count() % 10), ']',
+        };
+        return QString(timecode, TIMECODE_LENGTH);
+    }
+
     // TODO: What if minutes >= 100?
     return "[" + SerializeNumber(minutes.count(), 2) + ":" +
                  SerializeNumber(seconds.count(), 2) + ":" +
@@ -321,6 +438,7 @@ SoramimiSong::SoramimiSong(const QByteArray& data)
     stream.setCodec(Settings::GetLoadCodec(data));
     while (!stream.atEnd())
         m_lines.push_back(SetUpLine(std::make_unique<SoramimiLine>(stream.readLine())));
+    RebuildLineIndex();
 }
 
 SoramimiSong::SoramimiSong(const QVector<const Line*>& lines)
@@ -330,6 +448,7 @@ SoramimiSong::SoramimiSong(const QVector<const Line*>& lines)
         m_lines.push_back(SetUpLine(std::make_unique<SoramimiLine>(
                                     line->GetSyllables(), line->GetPrefix())));
     }
+    RebuildLineIndex();
 }
 
 QString SoramimiSong::GetRaw(int start_line, int end_line) const
@@ -386,6 +505,8 @@ void SoramimiSong::ReplaceLine(int line_index, const Line* replace_with)
                                     replace_with->GetSyllables(), replace_with->GetPrefix()));
 
     const int new_raw_length = m_lines[line_index]->GetRaw().size();
+    m_lines[line_index]->m_index = line_index;
+    UpdateLineLength(line_index);
 
     emit LinesChanged(line_index, 1, 1, LineNumberToRaw(line_index), old_raw_length, new_raw_length);
 }
@@ -429,6 +550,7 @@ void SoramimiSong::ReplaceLines(int start_line, int lines_to_remove,
         m_lines.insert(replace_it, std::make_move_iterator(lines_to_insert.begin()),
                                    std::make_move_iterator(lines_to_insert.end()));
     }
+    RebuildLineIndex();
 
     int new_raw_length = 0;
     if (!replace_with.empty())
@@ -447,6 +569,7 @@ void SoramimiSong::RemoveAllLines()
     const int lines_removed = m_lines.size();
     const int old_raw_length = LineNumberToRaw(lines_removed);
     m_lines.clear();
+    RebuildLineIndex();
     emit LinesChanged(0, lines_removed, 0, 0, old_raw_length, 0);
 }
 
@@ -457,17 +580,8 @@ bool SoramimiSong::SupportsPositionConversion() const
 
 SongPosition SoramimiSong::RawPositionFromRaw(int raw_position) const
 {
-    int line_number = 0;
-    int current_raw_pos = 0;
-    for (const std::unique_ptr<SoramimiLine>& line : m_lines)
-    {
-        const int new_raw_pos = current_raw_pos + line->GetRaw().size() + 1;
-        if (new_raw_pos > raw_position)
-            break;
-
-        line_number++;
-        current_raw_pos = new_raw_pos;
-    }
+    const int line_number = static_cast<int>(m_line_lengths.UpperBound(raw_position));
+    const int current_raw_pos = m_line_lengths.PrefixSum(line_number);
 
     const int position_in_line = raw_position - current_raw_pos;
     return {line_number, position_in_line};
@@ -475,17 +589,8 @@ SongPosition SoramimiSong::RawPositionFromRaw(int raw_position) const
 
 SongPosition SoramimiSong::PositionFromRaw(int raw_position) const
 {
-    int line_number = 0;
-    int current_raw_pos = 0;
-    for (const std::unique_ptr<SoramimiLine>& line : m_lines)
-    {
-        const int new_raw_pos = current_raw_pos + line->GetRaw().size() + 1;
-        if (new_raw_pos > raw_position)
-            break;
-
-        line_number++;
-        current_raw_pos = new_raw_pos;
-    }
+    const int line_number = static_cast<int>(m_line_lengths.UpperBound(raw_position));
+    const int current_raw_pos = m_line_lengths.PrefixSum(line_number);
 
     const int position_in_line = line_number >= m_lines.size() ? 0 :
                                  m_lines[line_number]->PositionFromRaw(raw_position - current_raw_pos);
@@ -494,10 +599,7 @@ SongPosition SoramimiSong::PositionFromRaw(int raw_position) const
 
 int SoramimiSong::LineNumberToRaw(int line) const
 {
-    int raw_position = 0;
-    for (size_t i = 0; i < line && i < m_lines.size(); ++i)
-        raw_position += m_lines[i]->GetRaw().size() + 1;
-    return raw_position;
+    return m_line_lengths.PrefixSum(std::min<size_t>(std::max(line, 0), m_lines.size()));
 }
 
 int SoramimiSong::PositionToRaw(SongPosition position) const
@@ -554,6 +656,7 @@ void SoramimiSong::UpdateRawText(int position, int chars_to_remove, QStringRef r
                                    std::make_move_iterator(lines_to_insert.end()));
         lines_to_skip = lines_to_insert.size();
     }
+    const bool lines_added_or_removed = lines_added_at_end != 0 || old_lines_count != new_lines_count;
 
     m_updates_disabled = true;
     if (new_lines_count == 1)
@@ -569,6 +672,17 @@ void SoramimiSong::UpdateRawText(int position, int chars_to_remove, QStringRef r
     }
     m_updates_disabled = false;
 
+    // Typing within a line only has to update that line
+    if (lines_added_or_removed)
+    {
+        RebuildLineIndex();
+    }
+    else
+    {
+        for (int i = start.line; i < start.line + new_lines_count; ++i)
+            UpdateLineLength(i);
+    }
+
     int new_raw_length = 0;
     if (!new_lines.empty())
     {
@@ -592,17 +706,32 @@ std::unique_ptr<SoramimiLine> SoramimiSong::SetUpLine(std::unique_ptr<SoramimiLi
 
 void SoramimiSong::EmitLineChanged(const SoramimiLine* line, int old_raw_length, int new_raw_length)
 {
+    // Whoever disabled updates takes care of the line index too
     if (m_updates_disabled)
         return;
 
+    const size_t i = line->m_index;
+    Q_ASSERT(i < m_lines.size() && m_lines[i].get() == line);
+
+    UpdateLineLength(i);
+    emit LinesChanged(i, 1, 1, LineNumberToRaw(i), old_raw_length, new_raw_length);
+}
+
+void SoramimiSong::RebuildLineIndex()
+{
+    std::vector<int> lengths;
+    lengths.reserve(m_lines.size());
     for (size_t i = 0; i < m_lines.size(); ++i)
     {
-        if (m_lines[i].get() == line)
-        {
-            emit LinesChanged(i, 1, 1, LineNumberToRaw(i), old_raw_length, new_raw_length);
-            break;
-        }
+        m_lines[i]->m_index = i;
+        lengths.push_back(m_lines[i]->GetRaw().size() + 1);
     }
+    m_line_lengths.Assign(std::move(lengths));
+}
+
+void SoramimiSong::UpdateLineLength(size_t line)
+{
+    m_line_lengths.Set(line, m_lines[line]->GetRaw().size() + 1);
 }
 
 }
@@ -12,6 +12,7 @@
 #include <QString>
 #include <QVector>
 
+#include "KaraokeData/FenwickTree.h"
 #include "KaraokeData/Song.h"
 
 namespace KaraokeData
@@ -25,36 +26,33 @@ typedef std::chrono::duration<int32_t, std::ratio<60, 1>> Minutes;
 
 class SoramimiSong;
 
+class SoramimiLine;
+
+// Refers to a syllable stored in a SoramimiLine. Only valid until the line is deserialized again
 class SoramimiSyllable final : public Syllable
 {
-    Q_OBJECT
-
-    friend class SoramimiLine;
-
 public:
-    SoramimiSyllable(const QString& text, Centiseconds start,
-                            Centiseconds end);
+    SoramimiSyllable(SoramimiLine* line, size_t index) : m_line(line), m_index(index) {}
 
-    QString GetText() const override { return m_text; }
+    QString GetText() const override;
     void SetText(const QString& text) override;
-    Centiseconds GetStart() const override { return m_start; }
+    Centiseconds GetStart() const override;
     void SetStart(Centiseconds time) override;
-    Centiseconds GetEnd() const override { return m_end; }
+    Centiseconds GetEnd() const override;
     void SetEnd(Centiseconds time) override;
 
-signals:
-    void Changed();
-
 private:
-    QString m_text;
-    Centiseconds m_start;
-    Centiseconds m_end;
+    SoramimiLine* m_line;
+    size_t m_index;
 };
 
 class SoramimiLine final : public Line
 {
     Q_OBJECT
 
+    friend class SoramimiSong;
+    friend class SoramimiSyllable;
+
 public:
     SoramimiLine(const QString& content);
     SoramimiLine(const QVector<const Syllable*>& syllables, QString prefix = QString());
@@ -80,17 +78,36 @@ private:
     void Deserialize();
     void CalculateStartAndEnd();
     void AddSyllable(int start, int end, Centiseconds start_time, Centiseconds end_time);
+    // Called by SoramimiSyllable after changing a syllable
+    void OnSyllableChanged();
+    void SetSyllableTime(size_t syllable, Centiseconds time, bool is_end);
+    // Rewrites the timecode in m_raw_content in place. Returns false if the
+    // layout of the line changes, which needs a full Serialize instead
+    bool PatchTimecode(size_t syllable, bool is_end);
 
     static QString SerializeTime(Centiseconds time);
     static QString SerializeNumber(int number, int digits);
 
     QString m_raw_content;
     std::vector<int> m_raw_syllable_positions;
-
-    std::vector<std::unique_ptr<SoramimiSyllable>> m_syllables;
+    // Where the timecodes of each syllable are in m_raw_content, or -1 if left out
+    std::vector<int> m_raw_start_timecode_positions;
+    std::vector<int> m_raw_end_timecode_positions;
+
+    // The syllables are stored one array per field. The texts are stored back to back,
+    // with syllable i being [m_syllable_text_offsets[i], m_syllable_text_offsets[i + 1])
+    QString m_syllable_texts;
+    std::vector<int> m_syllable_text_offsets;
+    std::vector<Centiseconds> m_syllable_starts;
+    std::vector<Centiseconds> m_syllable_ends;
+    // What GetSyllables hands out
+    std::vector<SoramimiSyllable> m_syllables;
     Centiseconds m_start;
     Centiseconds m_end;
     QString m_prefix;
+
+    // Where in SoramimiSong::m_lines this line is, kept up to date by SoramimiSong
+    size_t m_index = 0;
 };
 
 class SoramimiSong final : public Song
@@ -125,8 +142,14 @@ private:
     int LineNumberToRaw(int line) const;
     std::unique_ptr<SoramimiLine> SetUpLine(std::unique_ptr<SoramimiLine> line);
     void EmitLineChanged(const SoramimiLine* line, int old_raw_length, int new_raw_length);
+    // Must be called whenever lines have been added or removed. Updates the line indices and line lengths
+    void RebuildLineIndex();
+    void UpdateLineLength(size_t line);
 
     std::vector<std::unique_ptr<SoramimiLine>> m_lines;
+    // The raw length of each line plus one for the line break, for converting
+    // between line numbers and raw positions without going through every line
+    FenwickTree m_line_lengths;
     bool m_updates_disabled = false;
 };
 
@@ -9,9 +9,11 @@
 #include <utility>
 
 #include <QAction>
+#include <QCoreApplication>
 #include <QEvent>
 #include <QFont>
 #include <QInputDialog>
+#include <QKeyEvent>
 #include <QLocale>
 #include <QMenu>
 #include <QPair>
@@ -40,6 +42,7 @@ const QKeySequence LyricsEditor::TOGGLE_SYLLABLE = Qt::Key_Space | Qt::MetaModif
 #else
 const QKeySequence LyricsEditor::TOGGLE_SYLLABLE = Qt::Key_Space | Qt::ControlModifier;
 #endif
+const QKeySequence LyricsEditor::LOOP_LINE = Qt::Key_L | Qt::ControlModifier;
 
 static QFont WithPointSize(QFont font, qreal size)
 {
@@ -80,8 +83,50 @@ bool TimingEventFilter::eventFilter(QObject* obj, QEvent* event)
     }
 }
 
+// A key event that waited in the queue for longer than this is assumed to
+// have a timestamp in a time base that doesn't match the other events
+static constexpr std::chrono::seconds MAX_KEY_EVENT_DELAY(1);
+
+KeyTimestampFilter::KeyTimestampFilter(QObject* parent) : QObject(parent)
+{
+}
+
+PlaybackClock::Clock::time_point KeyTimestampFilter::GetLastKeyPressTime() const
+{
+    const PlaybackClock::Clock::time_point now = PlaybackClock::Clock::now();
+    // If the key press was long ago, whatever is asking isn't reacting to a key press
+    return now - m_last_key_press_time < MAX_KEY_EVENT_DELAY ? m_last_key_press_time : now;
+}
+
+bool KeyTimestampFilter::eventFilter(QObject* obj, QEvent* event)
+{
+    // Shortcuts are triggered by the ShortcutOverride event, and in that case, there's no KeyPress event
+    if ((event->type() == QEvent::ShortcutOverride || event->type() == QEvent::KeyPress) &&
+        !static_cast<QKeyEvent*>(event)->isAutoRepeat())
+    {
+        const PlaybackClock::Clock::time_point now = PlaybackClock::Clock::now();
+        const PlaybackClock::Clock::duration timestamp =
+                std::chrono::milliseconds(static_cast<QKeyEvent*>(event)->timestamp());
+        const PlaybackClock::Clock::duration offset = now.time_since_epoch() - timestamp;
+
+        // Some platforms don't provide timestamps, and the time base could in theory change
+        if (timestamp.count() == 0 || m_timestamp_offset == PlaybackClock::Clock::duration::max() ||
+            offset - m_timestamp_offset > MAX_KEY_EVENT_DELAY)
+            m_timestamp_offset = offset;
+        else
+            m_timestamp_offset = std::min(m_timestamp_offset, offset);
+
+        m_last_key_press_time = PlaybackClock::Clock::time_point(timestamp + m_timestamp_offset);
+    }
+
+    return QObject::eventFilter(obj, event);
+}
+
 LyricsEditor::LyricsEditor(QWidget* parent) : QWidget(parent)
 {
+    // The shortcuts can be activated no matter which widget has focus
+    QCoreApplication::instance()->installEventFilter(&m_key_timestamp_filter);
+
     m_raw_text_edit = new QPlainTextEdit();
     m_rich_text_edit = new QPlainTextEdit();
 
@@ -122,6 +167,9 @@ LyricsEditor::LyricsEditor(QWidget* parent) : QWidget(parent)
     m_toggle_syllable_shortcut = new QShortcut(TOGGLE_SYLLABLE, this);
     connect(m_toggle_syllable_shortcut, &QShortcut::activated,
             this, &LyricsEditor::ToggleSyllable);
+    m_loop_line_shortcut = new QShortcut(LOOP_LINE, this);
+    connect(m_loop_line_shortcut, &QShortcut::activated,
+            this, &LyricsEditor::ToggleLineLoop);
 
     m_rich_text_edit->setReadOnly(true);
 
@@ -158,6 +206,12 @@ void LyricsEditor::ReloadSong(KaraokeData::Song* song)
 {
     m_song_ref = song;
 
+    if (m_looped_line >= 0)
+    {
+        m_looped_line = -1;
+        emit LoopCleared();
+    }
+
     m_raw_updates_disabled = true;
     m_raw_text_edit->setPlainText(song->GetRaw());
     m_raw_updates_disabled = false;
@@ -189,6 +243,11 @@ void LyricsEditor::UpdateTime(std::chrono::milliseconds time)
     m_time = time;
 }
 
+void LyricsEditor::SetPlaybackClock(std::shared_ptr<const PlaybackClock> clock)
+{
+    m_clock = std::move(clock);
+}
+
 void LyricsEditor::UpdateSpeed(double speed)
 {
     m_speed = speed;
@@ -203,6 +262,7 @@ void LyricsEditor::SetMode(Mode mode)
     m_next_syllable_shortcut->setEnabled(mode == Mode::Timing);
     m_previous_line_shortcut->setEnabled(mode == Mode::Timing);
     m_next_line_shortcut->setEnabled(mode == Mode::Timing);
+    m_loop_line_shortcut->setEnabled(mode == Mode::Timing);
 
     m_toggle_syllable_shortcut->setEnabled(mode == Mode::Text);
 
@@ -286,6 +346,8 @@ void LyricsEditor::OnLinesChanged(int line_position, int lines_removed, int line
 
     emit Modified();
 
+    UpdateLoopedLine(line_position, lines_removed, lines_added);
+
     if (!m_raw_updates_disabled)
     {
         m_raw_updates_disabled = true;
@@ -1018,7 +1080,62 @@ KaraokeData::Centiseconds LyricsEditor::GetLatencyCompensatedTime() const
 {
     const std::chrono::milliseconds latency(static_cast<int>(Settings::video_latency.Get() / m_speed));
 
-    return std::chrono::duration_cast<KaraokeData::Centiseconds>(m_time - latency);
+    // m_time is only updated every now and then, but the clock knows the time at any moment,
+    // so ask it about the moment the key was pressed rather than the moment we got to handle it
+    std::chrono::microseconds time = m_time;
+    if (m_clock && m_clock->IsRunning())
+        time = m_clock->GetTime(m_key_timestamp_filter.GetLastKeyPressTime());
+
+    return std::chrono::duration_cast<KaraokeData::Centiseconds>(time - latency);
+}
+
+void LyricsEditor::ToggleLineLoop()
+{
+    // Pressing the shortcut again on the same line stops looping, but on another line, loops that line
+    const int line_index = TextPositionToLine(m_rich_text_edit->textCursor().position());
+    if (line_index == m_looped_line)
+    {
+        m_looped_line = -1;
+        emit LoopCleared();
+        return;
+    }
+
+    if (line_index < 0 || line_index >= m_line_timing_decorations.size())
+        return;
+
+    const KaraokeData::Line* line = m_song_ref->GetLines()[line_index];
+    const KaraokeData::Centiseconds start = line->GetStart();
+    const KaraokeData::Centiseconds end = line->GetEnd();
+    if (start == KaraokeData::PLACEHOLDER_TIME || end == KaraokeData::PLACEHOLDER_TIME || end <= start)
+        return;
+
+    m_looped_line = line_index;
+    emit LoopRequested(start, end);
+}
+
+void LyricsEditor::ForgetLoopedLine()
+{
+    m_looped_line = -1;
+}
+
+void LyricsEditor::UpdateLoopedLine(int line_position, int lines_removed, int lines_added)
+{
+    if (m_looped_line < line_position)
+        return;
+
+    if (m_looped_line >= line_position + lines_removed)
+    {
+        m_looped_line += lines_added - lines_removed;
+        return;
+    }
+
+    // A line that was changed in place is still the same line, for instance when its timings are
+    // being adjusted while it loops. The loop keeps the old times until the shortcut is pressed again
+    if (lines_removed == 1 && lines_added == 1)
+        return;
+
+    m_looped_line = -1;
+    emit LoopCleared();
 }
 
 void LyricsEditor::ToggleSyllable()
@@ -17,6 +17,7 @@
 #include "KaraokeData/Song.h"
 
 #include "LineTimingDecorations.h"
+#include "PlaybackClock.h"
 
 class TimingEventFilter : public QObject
 {
@@ -38,6 +39,29 @@ private:
     bool eventFilter(QObject* obj, QEvent* event) override;
 };
 
+// Keeps track of when the latest key press happened, according to the timestamp that the
+// OS gave the key event. That's more precise than checking the time once the event has
+// made it through the event queue, or once a QShortcut has been activated.
+class KeyTimestampFilter : public QObject
+{
+    Q_OBJECT
+
+public:
+    KeyTimestampFilter(QObject* parent = nullptr);
+
+    // Falls back to the current time if there's no usable key timestamp
+    PlaybackClock::Clock::time_point GetLastKeyPressTime() const;
+
+private:
+    bool eventFilter(QObject* obj, QEvent* event) override;
+
+    // Converts from event timestamps to steady_clock, whose epochs are unrelated.
+    // Since events can only arrive after they happen, the smallest difference
+    // between the time of arrival and the event timestamp is the best estimate
+    PlaybackClock::Clock::duration m_timestamp_offset = PlaybackClock::Clock::duration::max();
+    PlaybackClock::Clock::time_point m_last_key_press_time;
+};
+
 class LyricsEditor : public QWidget
 {
     Q_OBJECT
@@ -51,6 +75,7 @@ public:
     static const QKeySequence PREVIOUS_LINE;
     static const QKeySequence NEXT_LINE;
     static const QKeySequence TOGGLE_SYLLABLE;
+    static const QKeySequence LOOP_LINE;
 
     enum class Mode
     {
@@ -83,13 +108,19 @@ public:
 
     void AddActionsToMenu(QMenu* menu);
 
+    void SetPlaybackClock(std::shared_ptr<const PlaybackClock> clock);
+
 signals:
     void Modified();
+    void LoopRequested(std::chrono::milliseconds start, std::chrono::milliseconds end);
+    void LoopCleared();
 
 public slots:
     void ReloadSong(KaraokeData::Song* song);
     void UpdateTime(std::chrono::milliseconds time);
     void UpdateSpeed(double speed);
+    // Called when playback has stopped looping by itself
+    void ForgetLoopedLine();
 
 private slots:
     void OnLinesChanged(int line_position, int lines_removed, int lines_added,
@@ -107,6 +138,7 @@ private slots:
     void SetSyllableStart();
     void SetSyllableEnd();
     void ToggleSyllable();
+    void ToggleLineLoop();
 
 private:
     void AddLyricsActionsToMenu(QMenu* menu, QPlainTextEdit* text_edit);
@@ -119,6 +151,10 @@ private:
 
     void GoTo(SyllablePosition position);
 
+    // Keeps m_looped_line pointing at the same line when lines are added or removed before it,
+    // and stops looping if the line itself is removed
+    void UpdateLoopedLine(int line_position, int lines_removed, int lines_added);
+
     // Skips to the next line for as long as the current position is on a line that has no
     // syllables or the current position is at the end of a line, then returns the new position.
     SyllablePosition SkipLinesWithoutSyllablesForward(SyllablePosition position) const;
@@ -162,8 +198,10 @@ private:
     QShortcut* m_previous_line_shortcut;
     QShortcut* m_next_line_shortcut;
     QShortcut* m_toggle_syllable_shortcut;
+    QShortcut* m_loop_line_shortcut;
 
     TimingEventFilter m_timing_event_filter;
+    KeyTimestampFilter m_key_timestamp_filter;
 
     QPlainTextEdit* m_raw_text_edit;
     QPlainTextEdit* m_rich_text_edit;
@@ -171,7 +209,10 @@ private:
     std::vector<std::unique_ptr<LineTimingDecorations>> m_line_timing_decorations;
 
     std::chrono::milliseconds m_time = std::chrono::milliseconds(-1);
+    // More precise than m_time during playback
+    std::shared_ptr<const PlaybackClock> m_clock;
     double m_speed = 0.0;
+    int m_looped_line = -1;
 
     Mode m_mode;
 
@@ -16,6 +16,7 @@
 #include <QBuffer>
 
 #include "AboutDialog.h"
+#include "AudioDiagnosticsDialog.h"
 #include "KaraokeContainer/Container.h"
 #include "KaraokeContainer/PlainContainer.h"
 #include "KaraokeData/Song.h"
@@ -42,6 +43,10 @@ MainWindow::MainWindow(QWidget* parent) :
     connect(this, &MainWindow::SongReplaced, ui->playbackWidget, &PlaybackWidget::ReloadSong);
     connect(ui->playbackWidget, &PlaybackWidget::TimeUpdated, ui->mainLyrics, &LyricsEditor::UpdateTime);
     connect(ui->playbackWidget, &PlaybackWidget::SpeedUpdated, ui->mainLyrics, &LyricsEditor::UpdateSpeed);
+    ui->mainLyrics->SetPlaybackClock(ui->playbackWidget->GetPlaybackClock());
+    connect(ui->mainLyrics, &LyricsEditor::LoopRequested, ui->playbackWidget, &PlaybackWidget::SetLoop);
+    connect(ui->mainLyrics, &LyricsEditor::LoopCleared, ui->playbackWidget, &PlaybackWidget::ClearLoop);
+    connect(ui->playbackWidget, &PlaybackWidget::LoopCleared, ui->mainLyrics, &LyricsEditor::ForgetLoopedLine);
     connect(ui->mainLyrics, &LyricsEditor::Modified, this, &MainWindow::OnSongModified);
 
 #ifndef Q_OS_MACOS
@@ -171,6 +176,7 @@ void MainWindow::on_actionKeyboard_Shortcuts_triggered()
         {"Go to next syllable", LyricsEditor::NEXT_SYLLABLE},
         {"Go to start of previous line", LyricsEditor::PREVIOUS_LINE},
         {"Go to start of next line", LyricsEditor::NEXT_LINE},
+        {"Loop current line, or stop looping", LyricsEditor::LOOP_LINE},
     };
 
     QString text{};
@@ -210,6 +216,13 @@ void MainWindow::on_actionKeyboard_Shortcuts_triggered()
     m_keyboard_shortcuts_help = box;
 }
 
+void MainWindow::on_actionAudio_Diagnostics_triggered()
+{
+    AudioDiagnosticsDialog* dialog = new AudioDiagnosticsDialog(ui->playbackWidget->GetAudioStats(), this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->show();
+}
+
 void MainWindow::OnSongModified()
 {
     m_unsaved_changes = true;
@@ -228,7 +241,7 @@ void MainWindow::UpdateWindowTitle()
 
 void MainWindow::LoadAudio()
 {
-    ui->playbackWidget->LoadAudio(m_container ? m_container->ReadAudioFile() : nullptr);
+    ui->playbackWidget->LoadAudio(m_container ? m_container->MapAudioFile() : nullptr);
 }
 
 bool MainWindow::Save(QString path)
@@ -36,6 +36,7 @@ private slots:
     void on_actionSave_As_triggered();
     void on_actionAbout_Hibikase_triggered();
     void on_actionKeyboard_Shortcuts_triggered();
+    void on_actionAudio_Diagnostics_triggered();
 
     void OnSongModified();
 
@@ -3,10 +3,13 @@
 // This file implements a slider control that represents the current playback
 // position. Hibikase previously used QSlider for this, but its behaviour is not
 // consistent across platforms, and it can be quite glitchy. Using a custom
-// slider also lets us show what parts of the song have timed lines.
+// slider also lets us show what parts of the song have timed lines, as well
+// as the waveform of the audio.
 
 #include <algorithm>
 #include <chrono>
+#include <memory>
+#include <utility>
 
 #include <QBrush>
 #include <QColor>
@@ -25,7 +28,7 @@ const int LINE_HEIGHT = 4;
 const int HANDLE_WIDTH = 8;
 
 PlaybackBarWidget::PlaybackBarWidget(QWidget *parent)
-    : QWidget(parent), m_current_time{}, m_song_length{}, m_being_dragged{},
+    : QWidget(parent), m_current_time{}, m_song_length{}, m_decoded_length{}, m_being_dragged{},
       m_song_ref{}
 {
     setMinimumHeight(HEIGHT);
@@ -50,6 +53,18 @@ void PlaybackBarWidget::Update(Microseconds current_time, Microseconds song_leng
     update();
 }
 
+void PlaybackBarWidget::SetDecodedLength(Microseconds decoded_length)
+{
+    m_decoded_length = decoded_length;
+    update();
+}
+
+void PlaybackBarWidget::SetWaveform(std::shared_ptr<const WaveformPeaks> peaks)
+{
+    m_waveform = std::move(peaks);
+    update();
+}
+
 QRect PlaybackBarWidget::ComputeLineRect() const
 {
     int w = width() - HANDLE_WIDTH;
@@ -78,8 +93,21 @@ void PlaybackBarWidget::paintEvent(QPaintEvent* e)
 
     auto line_rect = ComputeLineRect();
     auto handle_rect = ComputeHandleRect();
+    PaintWaveform(&painter, line_rect, QPalette().color(QPalette::Text));
     painter.fillRect(line_rect, line_color);
 
+    // Fade out the part of the line that hasn't been decoded yet
+    if (m_decoded_length < m_song_length)
+    {
+        const qreal decoded = qreal(m_decoded_length.count()) / m_song_length.count();
+        QRectF undecoded_rect = line_rect;
+        undecoded_rect.setLeft(line_rect.x() + line_rect.width() * decoded);
+        QColor undecoded_color = line_color;
+        undecoded_color.setAlpha(96);
+        painter.fillRect(undecoded_rect, QPalette().color(QPalette::Window));
+        painter.fillRect(undecoded_rect, undecoded_color);
+    }
+
     if (m_song_ref)
     {
         auto song_length = qreal(std::chrono::duration_cast<KaraokeData::Centiseconds>(m_song_length).count());
@@ -106,6 +134,34 @@ void PlaybackBarWidget::paintEvent(QPaintEvent* e)
     QWidget::paintEvent(e);
 }
 
+void PlaybackBarWidget::PaintWaveform(QPainter* painter, const QRect& line_rect, const QColor& color)
+{
+    if (!m_waveform || line_rect.width() <= 0)
+        return;
+
+    // The peaks are looked up per pixel, so this costs the same no matter how long the song is
+    m_waveform_buffer.resize(line_rect.width());
+    m_waveform->GetPeaks(0, m_waveform->GetFrameCount(), line_rect.width(), m_waveform_buffer.data());
+
+    const qreal center = HEIGHT / 2.0;
+    const qreal scale = HEIGHT / 2.0;
+
+    QColor peak_color = color;
+    peak_color.setAlpha(64);
+    QColor rms_color = color;
+    rms_color.setAlpha(128);
+
+    for (int x = 0; x < line_rect.width(); ++x)
+    {
+        const WaveformPeaks::Peak& peak = m_waveform_buffer[x];
+        const qreal left = line_rect.x() + x;
+
+        painter->fillRect(QRectF(left, center - peak.max * scale, 1, (peak.max - peak.min) * scale),
+                          peak_color);
+        painter->fillRect(QRectF(left, center - peak.rms * scale, 1, 2 * peak.rms * scale), rms_color);
+    }
+}
+
 void PlaybackBarWidget::mousePressEvent(QMouseEvent* e)
 {
     m_being_dragged = true;
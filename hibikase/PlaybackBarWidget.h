@@ -3,12 +3,16 @@
 #pragma once
 
 #include <chrono>
+#include <memory>
+#include <vector>
 
 #include <QObject>
 #include <QWidget>
 
 #include "KaraokeData/Song.h"
+#include "WaveformPeaks.h"
 
+class QPainter;
 class QPaintEvent;
 
 class PlaybackBarWidget final : public QWidget
@@ -23,6 +27,7 @@ public:
     Microseconds GetCurrentTime() const;
     bool IsBeingDragged() const;
     void Update(Microseconds current_time, Microseconds song_length);
+    void SetDecodedLength(Microseconds decoded_length);
 
 signals:
     void Dragged(Microseconds new_time);
@@ -30,6 +35,7 @@ signals:
 
 public slots:
     void ReloadSong(KaraokeData::Song* song);
+    void SetWaveform(std::shared_ptr<const WaveformPeaks> peaks);
 
 protected:
     void paintEvent(QPaintEvent*) override;
@@ -43,6 +49,7 @@ private slots:
 private:
     Microseconds m_current_time;
     Microseconds m_song_length;
+    Microseconds m_decoded_length;
 
     bool m_being_dragged;
     bool m_drag_relative;
@@ -51,6 +58,10 @@ private:
 
     KaraokeData::Song* m_song_ref;
 
+    std::shared_ptr<const WaveformPeaks> m_waveform;
+    std::vector<WaveformPeaks::Peak> m_waveform_buffer;
+
     QRect ComputeLineRect() const;
     QRectF ComputeHandleRect() const;
+    void PaintWaveform(QPainter* painter, const QRect& line_rect, const QColor& color);
 };
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "PlaybackClock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+// If the clock doesn't get updated for a while (for instance because the output is waiting
+// for the decoder), don't run further ahead than this. The same goes for looking back in time
+static constexpr std::chrono::milliseconds MAX_EXTRAPOLATION(100);
+
+void PlaybackClock::Publish(qint64 output_frame, qint64 input_frame, double time_ratio, int sample_rate,
+                            bool running)
+{
+    const quint32 sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    m_output_frame.store(output_frame, std::memory_order_relaxed);
+    m_input_frame.store(input_frame, std::memory_order_relaxed);
+    m_timestamp.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    m_time_ratio.store(time_ratio, std::memory_order_relaxed);
+    m_sample_rate.store(sample_rate, std::memory_order_relaxed);
+    m_running.store(running, std::memory_order_relaxed);
+
+    m_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+PlaybackClock::Snapshot PlaybackClock::Read() const
+{
+    Snapshot snapshot;
+    quint32 sequence_before, sequence_after;
+    do
+    {
+        sequence_before = m_sequence.load(std::memory_order_acquire);
+
+        snapshot.output_frame = m_output_frame.load(std::memory_order_relaxed);
+        snapshot.input_frame = m_input_frame.load(std::memory_order_relaxed);
+        snapshot.timestamp = Clock::time_point(Clock::duration(m_timestamp.load(std::memory_order_relaxed)));
+        snapshot.time_ratio = m_time_ratio.load(std::memory_order_relaxed);
+        snapshot.sample_rate = m_sample_rate.load(std::memory_order_relaxed);
+        snapshot.running = m_running.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        sequence_after = m_sequence.load(std::memory_order_relaxed);
+    } while ((sequence_before & 1) || sequence_before != sequence_after);
+
+    return snapshot;
+}
+
+std::chrono::microseconds PlaybackClock::GetTime() const
+{
+    return GetTime(Clock::now());
+}
+
+std::chrono::microseconds PlaybackClock::GetTime(Clock::time_point time) const
+{
+    const Snapshot snapshot = Read();
+    if (snapshot.sample_rate == 0)
+        return std::chrono::microseconds(-1);
+
+    const std::chrono::microseconds base(snapshot.input_frame * 1000000 / snapshot.sample_rate);
+    if (!snapshot.running)
+        return base;
+
+    // While playing at a time ratio of 2, the file advances at half the speed of the wall clock
+    const std::chrono::microseconds elapsed = std::max(-std::chrono::microseconds(MAX_EXTRAPOLATION), std::min(
+            std::chrono::duration_cast<std::chrono::microseconds>(time - snapshot.timestamp),
+            std::chrono::microseconds(MAX_EXTRAPOLATION)));
+    return base + std::chrono::microseconds(static_cast<qint64>(elapsed.count() / snapshot.time_ratio));
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+#include <QtGlobal>
+
+// The playback position, published by the audio thread and readable from any thread
+// without locking or waiting for the event loop. Between updates, readers extrapolate
+// the position from the time that has passed since the last update.
+// Only one thread may call Publish.
+class PlaybackClock final
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Snapshot
+    {
+        // How many frames the audio output had played when the snapshot was taken
+        qint64 output_frame;
+        // The frame of the file that was being heard at that moment
+        qint64 input_frame;
+        Clock::time_point timestamp;
+        double time_ratio;
+        int sample_rate;
+        bool running;
+    };
+
+    PlaybackClock() = default;
+
+    PlaybackClock(const PlaybackClock&) = delete;
+    PlaybackClock& operator=(const PlaybackClock&) = delete;
+
+    void Publish(qint64 output_frame, qint64 input_frame, double time_ratio, int sample_rate, bool running);
+
+    Snapshot Read() const;
+
+    // The position in the file that is being heard right now, or at the given time
+    // (which should be close to now). Negative if no audio has been published yet
+    std::chrono::microseconds GetTime() const;
+    std::chrono::microseconds GetTime(Clock::time_point time) const;
+
+    bool IsRunning() const
+    {
+        return Read().running;
+    }
+
+private:
+    // A seqlock. The sequence number is odd while the writer is updating the fields
+    std::atomic<quint32> m_sequence{0};
+
+    std::atomic<qint64> m_output_frame{0};
+    std::atomic<qint64> m_input_frame{0};
+    std::atomic<Clock::rep> m_timestamp{0};
+    std::atomic<double> m_time_ratio{1.0};
+    std::atomic<int> m_sample_rate{0};
+    std::atomic<bool> m_running{false};
+};
@@ -7,6 +7,7 @@
 #include <QHBoxLayout>
 #include <QVBoxLayout>
 #include <QFontDatabase>
+#include <QMessageBox>
 
 static double ConvertSpeed(int speed)
 {
@@ -76,21 +77,47 @@ void PlaybackWidget::ReloadSong(KaraokeData::Song* song)
     m_playback_bar->ReloadSong(song);
 }
 
-void PlaybackWidget::LoadAudio(std::unique_ptr<QIODevice> io_device)
+void PlaybackWidget::SetLoop(std::chrono::milliseconds start, std::chrono::milliseconds end)
+{
+    if (!m_worker)
+        return;
+
+    const std::chrono::microseconds start_us(start);
+    const std::chrono::microseconds end_us(end);
+    QMetaObject::invokeMethod(m_worker, "SetLoop", Q_ARG(std::chrono::microseconds, start_us),
+                              Q_ARG(std::chrono::microseconds, end_us));
+}
+
+void PlaybackWidget::ClearLoop()
+{
+    if (m_worker)
+        QMetaObject::invokeMethod(m_worker, "ClearLoop");
+}
+
+void PlaybackWidget::LoadAudio(std::unique_ptr<KaraokeContainer::MappedFile> file)
 {
     if (m_worker)
     {
         disconnect(m_worker, &AudioOutputWorker::PlaybackStateChanged, this, &PlaybackWidget::OnStateChanged);
         disconnect(m_worker, &AudioOutputWorker::TimeUpdated, this, &PlaybackWidget::UpdateTime);
+        disconnect(m_worker, &AudioOutputWorker::LoadProgress, this, &PlaybackWidget::OnLoadProgress);
+        disconnect(m_worker, &AudioOutputWorker::DecodeFailed, this, &PlaybackWidget::OnDecodeFailed);
+        disconnect(m_worker, &AudioOutputWorker::LoopCleared, this, &PlaybackWidget::LoopCleared);
+        disconnect(m_worker, &AudioOutputWorker::WaveformAvailable, m_playback_bar, &PlaybackBarWidget::SetWaveform);
         QMetaObject::invokeMethod(m_worker, "deleteLater");
         m_worker = nullptr;
+
+        // Any loop went away with the worker
+        emit LoopCleared();
     }
 
     m_play_button->setEnabled(false);
     m_stop_button->setEnabled(false);
+    m_playback_bar->SetDecodedLength(std::chrono::microseconds::zero());
+    m_playback_bar->SetWaveform(nullptr);
     OnStateChanged(AudioOutputWorker::PlaybackState::Stopped);
 
-    if (!io_device)
+    if (!file)
     {
         m_play_button->setText("(No audio loaded)");
         return;
@@ -98,7 +125,7 @@ void PlaybackWidget::LoadAudio(std::unique_ptr<QIODevice> io_device)
 
     m_play_button->setText("(Loading audio...)");
 
-    m_worker = new AudioOutputWorker(std::move(io_device));
+    m_worker = new AudioOutputWorker(std::move(file), m_clock, m_stats);
     m_worker->moveToThread(&m_thread);
 
     connect(m_worker, &AudioOutputWorker::LoadFinished, this, &PlaybackWidget::OnLoadResult);
@@ -106,6 +133,10 @@ void PlaybackWidget::LoadAudio(std::unique_ptr<QIODevice> io_device)
 
     connect(m_worker, &AudioOutputWorker::PlaybackStateChanged, this, &PlaybackWidget::OnStateChanged);
     connect(m_worker, &AudioOutputWorker::TimeUpdated, this, &PlaybackWidget::UpdateTime);
+    connect(m_worker, &AudioOutputWorker::LoadProgress, this, &PlaybackWidget::OnLoadProgress);
+    connect(m_worker, &AudioOutputWorker::DecodeFailed, this, &PlaybackWidget::OnDecodeFailed);
+    connect(m_worker, &AudioOutputWorker::LoopCleared, this, &PlaybackWidget::LoopCleared);
+    connect(m_worker, &AudioOutputWorker::WaveformAvailable, m_playback_bar, &PlaybackBarWidget::SetWaveform);
 }
 
 void PlaybackWidget::OnLoadResult(QString result)
@@ -120,6 +151,20 @@ void PlaybackWidget::OnLoadResult(QString result)
     OnStateChanged(AudioOutputWorker::PlaybackState::Stopped);
 }
 
+void PlaybackWidget::OnLoadProgress(std::chrono::microseconds decoded, std::chrono::microseconds)
+{
+    // Playback is possible as soon as loading has finished, but the audio is
+    // still being decoded in the background, and seeking is limited to the
+    // part that has been decoded
+    m_playback_bar->SetDecodedLength(decoded);
+}
+
+void PlaybackWidget::OnDecodeFailed(QString error)
+{
+    // Playback has already started by now, so don't take it away, just say why the audio ends early
+    QMessageBox::warning(this, QStringLiteral("Error"), "Could not decode all of the audio: " + error);
+}
+
 void PlaybackWidget::OnPlayButtonClicked()
 {
     if (!m_worker)
@@ -144,9 +189,11 @@ void PlaybackWidget::OnStopButtonClicked()
 
 void PlaybackWidget::OnPlaybackBarDragged(std::chrono::microseconds value)
 {
-    // Update karaoke text but not audio when dragging slider
-    // (It would also be possible to update audio, but you may not like the sound)
     emit TimeUpdated(std::chrono::duration_cast<std::chrono::milliseconds>(value));
+
+    // Let the user hear where they are
+    if (m_worker)
+        QMetaObject::invokeMethod(m_worker, "Scrub", Q_ARG(std::chrono::microseconds, value));
 }
 
 void PlaybackWidget::OnPlaybackBarReleased()
@@ -155,7 +202,7 @@ void PlaybackWidget::OnPlaybackBarReleased()
         return;
 
     std::chrono::microseconds new_pos(m_playback_bar->GetCurrentTime());
-    QMetaObject::invokeMethod(m_worker, "Seek", Q_ARG(std::chrono::microseconds, new_pos));
+    QMetaObject::invokeMethod(m_worker, "EndScrub", Q_ARG(std::chrono::microseconds, new_pos));
 }
 
 void PlaybackWidget::OnSpeedSliderUpdated(int value)
@@ -12,8 +12,11 @@
 #include <QWidget>
 
 #include "AudioOutputWorker.h"
+#include "AudioStats.h"
+#include "KaraokeContainer/MappedFile.h"
 #include "KaraokeData/Song.h"
 #include "PlaybackBarWidget.h"
+#include "PlaybackClock.h"
 
 class PlaybackWidget : public QWidget
 {
@@ -23,17 +26,34 @@ public:
     explicit PlaybackWidget(QWidget* parent = nullptr);
     ~PlaybackWidget();
 
-    void LoadAudio(std::unique_ptr<QIODevice> io_device);  // Can be nullptr
+    void LoadAudio(std::unique_ptr<KaraokeContainer::MappedFile> file);  // Can be nullptr
+
+    // These stay the same when other audio is loaded
+    std::shared_ptr<const PlaybackClock> GetPlaybackClock() const
+    {
+        return m_clock;
+    }
+    std::shared_ptr<AudioStats> GetAudioStats() const
+    {
+        return m_stats;
+    }
 
 signals:
     void TimeUpdated(std::chrono::milliseconds time);
     void SpeedUpdated(double speed);
+    // The loop from SetLoop has ended without ClearLoop being called,
+    // for instance because the user seeked elsewhere or other audio was loaded
+    void LoopCleared();
 
 public slots:
     void ReloadSong(KaraokeData::Song* song);
+    void SetLoop(std::chrono::milliseconds start, std::chrono::milliseconds end);
+    void ClearLoop();
 
 private slots:
     void OnLoadResult(QString result);
+    void OnLoadProgress(std::chrono::microseconds decoded, std::chrono::microseconds length);
+    void OnDecodeFailed(QString error);
     void OnPlayButtonClicked();
     void OnStopButtonClicked();
     void OnPlaybackBarDragged(std::chrono::microseconds new_time);
@@ -54,6 +74,8 @@ private:
     QSlider* m_speed_slider;
 
     AudioOutputWorker* m_worker = nullptr;
+    std::shared_ptr<PlaybackClock> m_clock = std::make_shared<PlaybackClock>();
+    std::shared_ptr<AudioStats> m_stats = std::make_shared<AudioStats>();
     QThread m_thread;
 
     AudioOutputWorker::PlaybackState m_state;
@@ -0,0 +1,197 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "RealTimeStretcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "Settings.h"
+
+using Stretcher = RubberBand::RubberBandStretcher;
+
+Stretcher::Options RealTimeStretcher::GetQualityOptionsFromSettings()
+{
+    // In the same order as the choices of the settings
+    static constexpr Stretcher::Options TRANSIENTS[] = {
+        Stretcher::Option::OptionTransientsCrisp,
+        Stretcher::Option::OptionTransientsMixed,
+        Stretcher::Option::OptionTransientsSmooth,
+    };
+    static constexpr Stretcher::Options WINDOWS[] = {
+        Stretcher::Option::OptionWindowStandard,
+        Stretcher::Option::OptionWindowShort,
+        Stretcher::Option::OptionWindowLong,
+    };
+
+    const int transients = std::max(0, std::min(Settings::stretcher_transients.Get(), 2));
+    const int window = std::max(0, std::min(Settings::stretcher_window.Get(), 2));
+    return TRANSIENTS[transients] | WINDOWS[window];
+}
+
+RealTimeStretcher::Threading RealTimeStretcher::ChooseThreading(size_t channel_count, qint64 load_percent)
+{
+    // Handing the channels over to other threads costs a little, so only do it if stretching
+    // on one thread takes more than half of the time it has, and if every channel can get a
+    // core of its own with one left over for the decoder and the audio output
+    const size_t cores = std::thread::hardware_concurrency();
+    if (channel_count > 1 && cores >= channel_count + 1 && load_percent > 50)
+        return Threading::PerChannel;
+
+    return Threading::Single;
+}
+
+RealTimeStretcher::RealTimeStretcher(size_t sample_rate, size_t channel_count, Threading threading,
+                                     Stretcher::Options quality_options, double pitch_scale)
+    : m_threading(channel_count > 1 ? threading : Threading::Single), m_quality_options(quality_options)
+{
+    // The pitch scale never changes, so it may as well be done the best way
+    Stretcher::Options options = Stretcher::Option::OptionProcessRealTime | quality_options;
+    if (pitch_scale != 1.0)
+        options |= Stretcher::Option::OptionPitchHighQuality;
+
+    if (m_threading == Threading::Single)
+    {
+        m_stretchers.push_back(std::make_unique<Stretcher>(sample_rate, channel_count, options));
+        m_stretchers.front()->setPitchScale(pitch_scale);
+        return;
+    }
+
+    for (size_t i = 0; i < channel_count; ++i)
+    {
+        m_stretchers.push_back(std::make_unique<Stretcher>(sample_rate, 1, options));
+        m_stretchers.back()->setPitchScale(pitch_scale);
+    }
+    m_channel_retrieved.resize(channel_count);
+    for (size_t i = 1; i < channel_count; ++i)
+        m_threads.emplace_back(&RealTimeStretcher::RunChannel, this, i);
+}
+
+RealTimeStretcher::~RealTimeStretcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_job_condition.notify_all();
+    for (std::thread& thread : m_threads)
+        thread.join();
+}
+
+void RealTimeStretcher::Reset()
+{
+    for (std::unique_ptr<Stretcher>& stretcher : m_stretchers)
+        stretcher->reset();
+}
+
+void RealTimeStretcher::SetTimeRatio(double time_ratio)
+{
+    for (std::unique_ptr<Stretcher>& stretcher : m_stretchers)
+        stretcher->setTimeRatio(time_ratio);
+}
+
+size_t RealTimeStretcher::GetLatency() const
+{
+    return m_stretchers.front()->getLatency();
+}
+
+size_t RealTimeStretcher::GetSamplesRequired() const
+{
+    size_t required = 0;
+    for (const std::unique_ptr<Stretcher>& stretcher : m_stretchers)
+        required = std::max(required, stretcher->getSamplesRequired());
+    return required;
+}
+
+int RealTimeStretcher::Available() const
+{
+    // The channels get the same input, so they run out at the same time. Until all of them
+    // have, only report what every channel can deliver
+    int available = -1;
+    for (const std::unique_ptr<Stretcher>& stretcher : m_stretchers)
+    {
+        const int channel_available = stretcher->available();
+        if (channel_available >= 0)
+            available = available < 0 ? channel_available : std::min(available, channel_available);
+    }
+    return available;
+}
+
+size_t RealTimeStretcher::Retrieve(float* const* output, size_t frames)
+{
+    if (m_threading == Threading::Single)
+        return m_stretchers.front()->retrieve(output, frames);
+
+    // A channel that has run out early is padded with silence
+    size_t retrieved = 0;
+    for (size_t i = 0; i < m_stretchers.size(); ++i)
+    {
+        m_channel_retrieved[i] = m_stretchers[i]->retrieve(output + i, frames);
+        retrieved = std::max(retrieved, m_channel_retrieved[i]);
+    }
+    for (size_t i = 0; i < m_stretchers.size(); ++i)
+        std::fill(output[i] + m_channel_retrieved[i], output[i] + retrieved, 0.0f);
+
+    return retrieved;
+}
+
+void RealTimeStretcher::Process(const float* const* input, size_t frames, bool final)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    if (m_threading == Threading::Single)
+    {
+        m_stretchers.front()->process(input, frames, final);
+        m_last_process_work = std::chrono::steady_clock::now() - start_time;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job_input = input;
+        m_job_frames = frames;
+        m_job_final = final;
+        m_job_pending = m_threads.size();
+        m_job_work = std::chrono::nanoseconds(0);
+        ++m_job_generation;
+    }
+    m_job_condition.notify_all();
+
+    m_stretchers.front()->process(input, frames, final);
+    const std::chrono::nanoseconds own_work = std::chrono::steady_clock::now() - start_time;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done_condition.wait(lock, [this] { return m_job_pending == 0; });
+    m_last_process_work = own_work + m_job_work;
+}
+
+void RealTimeStretcher::RunChannel(size_t channel)
+{
+    quint64 generation = 0;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_job_condition.wait(lock, [this, generation] { return m_quit || m_job_generation != generation; });
+        if (m_quit)
+            return;
+
+        generation = m_job_generation;
+        const float* const* input = m_job_input;
+        const size_t frames = m_job_frames;
+        const bool final = m_job_final;
+        lock.unlock();
+
+        const auto start_time = std::chrono::steady_clock::now();
+        m_stretchers[channel]->process(input + channel, frames, final);
+        const auto end_time = std::chrono::steady_clock::now();
+
+        lock.lock();
+        m_job_work += end_time - start_time;
+        if (--m_job_pending == 0)
+        {
+            lock.unlock();
+            m_done_condition.notify_one();
+        }
+    }
+}
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QtGlobal>
+
+#include <RubberBandStretcher.h>
+
+// RubberBand's real-time stretcher, which RubberBand itself always runs on the calling
+// thread. With Threading::PerChannel, every channel instead gets a stretcher of its own,
+// and the channels are processed in parallel (the first one on the calling thread, the
+// others on threads that are kept around for the lifetime of the RealTimeStretcher).
+// The channels are then stretched independently of each other, like with
+// OptionChannelsApart, which can widen the stereo image slightly.
+class RealTimeStretcher final
+{
+public:
+    enum class Threading
+    {
+        Single,
+        PerChannel,
+    };
+
+    // Options that affect how the output sounds, taken from Settings. Call from the GUI or worker thread
+    static RubberBand::RubberBandStretcher::Options GetQualityOptionsFromSettings();
+    // Given the 99th percentile of the stretcher's load on a single thread (see
+    // GetLastProcessWork), picks the threading that keeps it comfortably within real time
+    static Threading ChooseThreading(size_t channel_count, qint64 load_percent);
+
+    // A pitch_scale other than 1 is used for changing the sample rate in the same pass as the stretching
+    RealTimeStretcher(size_t sample_rate, size_t channel_count, Threading threading,
+                      RubberBand::RubberBandStretcher::Options quality_options, double pitch_scale);
+    ~RealTimeStretcher();
+
+    RealTimeStretcher(const RealTimeStretcher&) = delete;
+    RealTimeStretcher& operator=(const RealTimeStretcher&) = delete;
+
+    Threading GetThreading() const { return m_threading; }
+    RubberBand::RubberBandStretcher::Options GetQualityOptions() const { return m_quality_options; }
+
+    // These work like the RubberBandStretcher functions of the same names
+
+    void Reset();
+    void SetTimeRatio(double time_ratio);
+    size_t GetLatency() const;
+    size_t GetSamplesRequired() const;
+    int Available() const;
+    size_t Retrieve(float* const* output, size_t frames);
+    void Process(const float* const* input, size_t frames, bool final);
+
+    // How long the last call to Process took on all threads together, which is
+    // how long it would have taken with Threading::Single
+    std::chrono::nanoseconds GetLastProcessWork() const { return m_last_process_work; }
+
+private:
+    void RunChannel(size_t channel);
+
+    const Threading m_threading;
+    const RubberBand::RubberBandStretcher::Options m_quality_options;
+    // One stretcher for all channels, or one per channel
+    std::vector<std::unique_ptr<RubberBand::RubberBandStretcher>> m_stretchers;
+    // Allocated once, so that retrieving never has to allocate memory
+    std::vector<size_t> m_channel_retrieved;
+
+    // The job handed to the channel threads. Everything below is protected by m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_job_condition;
+    std::condition_variable m_done_condition;
+    const float* const* m_job_input = nullptr;
+    size_t m_job_frames = 0;
+    bool m_job_final = false;
+    // Incremented for every job, so that each channel thread knows when there's a new one
+    quint64 m_job_generation = 0;
+    size_t m_job_pending = 0;
+    // The time the channel threads have spent on the current job
+    std::chrono::nanoseconds m_job_work{0};
+    bool m_quit = false;
+
+    // Only used by the thread that calls Process
+    std::chrono::nanoseconds m_last_process_work{0};
+
+    std::vector<std::thread> m_threads;
+};
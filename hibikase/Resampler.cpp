@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "Resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include <QDebug>
+
+#include <speex_resampler.h>
+
+// Speex's own recommendation for desktop use is 5. 7 costs a little more, but the
+// audio is music that may get listened to closely
+static constexpr int QUALITY = 7;
+// The length of the filter at quality 7. When downsampling, it gets longer by the ratio
+static constexpr double FILTER_FRAMES = 128;
+
+std::unique_ptr<Resampler> Resampler::Create(size_t channel_count, int input_sample_rate, int output_sample_rate)
+{
+    int error = RESAMPLER_ERR_SUCCESS;
+    SpeexResamplerState* state = speex_resampler_init(static_cast<spx_uint32_t>(channel_count),
+                                                      static_cast<spx_uint32_t>(input_sample_rate),
+                                                      static_cast<spx_uint32_t>(output_sample_rate), QUALITY, &error);
+    if (!state || error != RESAMPLER_ERR_SUCCESS)
+    {
+        qWarning() << "Could not create a resampler from" << input_sample_rate << "Hz to" << output_sample_rate
+                   << "Hz:" << speex_resampler_strerror(error);
+        if (state)
+            speex_resampler_destroy(state);
+        return nullptr;
+    }
+
+    // Half of the filter reaches into the future
+    const double downsampling = std::max(1.0, static_cast<double>(input_sample_rate) / output_sample_rate);
+    const size_t max_latency = static_cast<size_t>(std::ceil(FILTER_FRAMES / 2 * downsampling));
+
+    std::unique_ptr<Resampler> resampler(new Resampler(state, channel_count, max_latency));
+    resampler->Reset();
+    return resampler;
+}
+
+Resampler::Resampler(SpeexResamplerState* state, size_t channel_count, size_t max_latency)
+    : m_state(state), m_channel_count(channel_count), m_max_latency(max_latency)
+{
+}
+
+Resampler::~Resampler()
+{
+    speex_resampler_destroy(m_state);
+}
+
+void Resampler::Reset()
+{
+    speex_resampler_reset_mem(m_state);
+    // Without this, the output would start with the delay of the filter
+    speex_resampler_skip_zeros(m_state);
+}
+
+void Resampler::Process(const float* const* input, size_t* input_frames, float* const* output, size_t* output_frames)
+{
+    // Every channel reads and writes the same number of frames
+    spx_uint32_t read = 0;
+    spx_uint32_t written = 0;
+    for (size_t i = 0; i < m_channel_count; ++i)
+    {
+        read = static_cast<spx_uint32_t>(*input_frames);
+        written = static_cast<spx_uint32_t>(*output_frames);
+        speex_resampler_process_float(m_state, static_cast<spx_uint32_t>(i), input[i], &read, output[i], &written);
+    }
+
+    *input_frames = read;
+    *output_frames = written;
+}
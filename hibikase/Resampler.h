@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <memory>
+
+struct SpeexResamplerState_;
+
+// Changes the sample rate of planar float audio, using the Speex resampler that comes with
+// RubberBand. Used at 100% speed, where the stretcher would otherwise have to run only to
+// resample. The output lines up with the input, without the delay of the filter.
+class Resampler final
+{
+public:
+    // Returns nullptr if the resampler couldn't be set up for these sample rates
+    static std::unique_ptr<Resampler> Create(size_t channel_count, int input_sample_rate, int output_sample_rate);
+    ~Resampler();
+
+    Resampler(const Resampler&) = delete;
+    Resampler& operator=(const Resampler&) = delete;
+
+    // Forgets the previous input, for when the input jumps somewhere else
+    void Reset();
+    // Reads up to *input_frames frames and writes up to *output_frames frames, and sets
+    // them to how many frames were actually read and written
+    void Process(const float* const* input, size_t* input_frames, float* const* output, size_t* output_frames);
+    // The most input frames that the resampler can be holding on to without having output them.
+    // At the end of the input, this much silence pushes out the rest of the audio
+    size_t GetMaxLatency() const { return m_max_latency; }
+
+private:
+    Resampler(SpeexResamplerState_* state, size_t channel_count, size_t max_latency);
+
+    SpeexResamplerState_* m_state;
+    const size_t m_channel_count;
+    const size_t m_max_latency;
+};
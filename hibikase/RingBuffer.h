@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// A lock-free ring buffer for one producer thread and one consumer thread.
+// Write and GetWritable may only be called by the producer, and Read and
+// GetReadable only by the consumer.
+template <typename T>
+class RingBuffer final
+{
+public:
+    // The capacity gets rounded up to a power of two
+    explicit RingBuffer(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        m_buffer.resize(size);
+        m_mask = size - 1;
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    size_t GetCapacity() const
+    {
+        return m_buffer.size();
+    }
+
+    size_t GetReadable() const
+    {
+        return m_write_index.load(std::memory_order_acquire) - m_read_index.load(std::memory_order_relaxed);
+    }
+
+    size_t GetWritable() const
+    {
+        return m_buffer.size() -
+               (m_write_index.load(std::memory_order_relaxed) - m_read_index.load(std::memory_order_acquire));
+    }
+
+    // Returns how many elements were written
+    size_t Write(const T* data, size_t count)
+    {
+        const size_t write_index = m_write_index.load(std::memory_order_relaxed);
+        count = std::min(count, GetWritable());
+
+        const size_t offset = write_index & m_mask;
+        const size_t first_part = std::min(count, m_buffer.size() - offset);
+        std::copy(data, data + first_part, m_buffer.data() + offset);
+        std::copy(data + first_part, data + count, m_buffer.data());
+
+        m_write_index.store(write_index + count, std::memory_order_release);
+        return count;
+    }
+
+    // Returns how many elements were read
+    size_t Read(T* data, size_t count)
+    {
+        const size_t read_index = m_read_index.load(std::memory_order_relaxed);
+        count = std::min(count, GetReadable());
+
+        const size_t offset = read_index & m_mask;
+        const size_t first_part = std::min(count, m_buffer.size() - offset);
+        std::copy(m_buffer.data() + offset, m_buffer.data() + offset + first_part, data);
+        std::copy(m_buffer.data(), m_buffer.data() + count - first_part, data + first_part);
+
+        m_read_index.store(read_index + count, std::memory_order_release);
+        return count;
+    }
+
+    // How many elements have been written in total. The consumer must not use this
+    size_t GetWritePosition() const
+    {
+        return m_write_index.load(std::memory_order_relaxed);
+    }
+
+    // Throws away the elements that were written before the producer reached the given
+    // write position, if they haven't been read yet. Returns how many elements were thrown away.
+    // Only the consumer may call this
+    size_t DiscardUntil(size_t write_position)
+    {
+        const size_t read_index = m_read_index.load(std::memory_order_relaxed);
+        // The indices wrap around, so compare their difference rather than the indices themselves
+        const size_t count = write_position - read_index;
+        if (count == 0 || count > m_buffer.size())
+            return 0;
+
+        m_read_index.store(write_position, std::memory_order_release);
+        return count;
+    }
+
+    // Empties the buffer. Neither the producer nor the consumer may be active at the same time
+    void Reset()
+    {
+        m_write_index.store(0, std::memory_order_relaxed);
+        m_read_index.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::vector<T> m_buffer;
+    size_t m_mask;
+
+    // Kept on separate cache lines, so that the two threads don't slow each other down
+    alignas(64) std::atomic<size_t> m_write_index{0};
+    alignas(64) std::atomic<size_t> m_read_index{0};
+};
@@ -43,6 +43,23 @@ Setting<qreal> Settings::raw_font_size{"RawFontSize", "Font size in Raw view", 9
 
 Setting<int> Settings::audio_latency{"AudioLatency", "Audio latency (ms)", 0};
 Setting<int> Settings::video_latency{"VideoLatency", "Video latency (ms)", 0};
+Setting<int> Settings::audio_buffer_size{"AudioBufferSize", "Audio buffer size (ms)", 100};
+
+Setting<bool> Settings::audio_cache_enabled{"AudioCacheEnabled", "Cache decoded audio on disk", false};
+Setting<int> Settings::audio_cache_size{"AudioCacheSizeGB", "Decoded audio cache size (GB)", 4};
+Setting<bool> Settings::audio_low_memory{"AudioLowMemory",
+                                         "Only decode the audio around the playback position (uses less memory)",
+                                         false};
+Setting<bool> Settings::audio_prerender{"AudioPrerender",
+                                        "Prepare slowed down audio in the background (uses more memory)",
+                                        true};
+
+ChoiceSetting Settings::stretcher_threads{"StretcherThreads", "Time-stretching threads",
+                                          {"Automatic", "One", "One per channel"}, 0};
+ChoiceSetting Settings::stretcher_transients{"StretcherTransients", "Time-stretching of transients",
+                                             {"Crisp", "Mixed", "Smooth"}, 0};
+ChoiceSetting Settings::stretcher_window{"StretcherWindow", "Time-stretching window size",
+                                         {"Standard", "Short (better for speech)", "Long (better for music)"}, 0};
 
 Setting<qreal>* const Settings::REAL_SETTINGS[] = {
     &timing_text_font_size,
@@ -52,4 +69,18 @@ Setting<qreal>* const Settings::REAL_SETTINGS[] = {
 Setting<int>* const Settings::INT_SETTINGS[] = {
     &audio_latency,
     &video_latency,
+    &audio_buffer_size,
+    &audio_cache_size,
+};
+
+Setting<bool>* const Settings::BOOL_SETTINGS[] = {
+    &audio_cache_enabled,
+    &audio_low_memory,
+    &audio_prerender,
+};
+
+ChoiceSetting* const Settings::CHOICE_SETTINGS[] = {
+    &stretcher_threads,
+    &stretcher_transients,
+    &stretcher_window,
 };
@@ -5,10 +5,12 @@
 #include <QByteArray>
 #include <QSettings>
 #include <QString>
+#include <QStringList>
 #include <QTextCodec>
 
 template <typename T>
 class Setting;
+class ChoiceSetting;
 
 class Settings
 {
@@ -26,9 +28,21 @@ public:
 
     static Setting<int> audio_latency;
     static Setting<int> video_latency;
+    static Setting<int> audio_buffer_size;
+
+    static Setting<bool> audio_cache_enabled;
+    static Setting<int> audio_cache_size;
+    static Setting<bool> audio_low_memory;
+    static Setting<bool> audio_prerender;
+
+    static ChoiceSetting stretcher_threads;
+    static ChoiceSetting stretcher_transients;
+    static ChoiceSetting stretcher_window;
 
     static Setting<qreal>* const REAL_SETTINGS[2];
-    static Setting<int>* const INT_SETTINGS[2];
+    static Setting<int>* const INT_SETTINGS[4];
+    static Setting<bool>* const BOOL_SETTINGS[3];
+    static ChoiceSetting* const CHOICE_SETTINGS[3];
 
 private:
     static QSettings* GetQSettings()
@@ -86,3 +100,15 @@ private:
     std::function<void(T)> m_callback;
     T m_cached_value;
 };
+
+// The value is the index of the chosen choice
+class ChoiceSetting final : public Setting<int>
+{
+public:
+    ChoiceSetting(QString name, QString friendly_name, QStringList choices, int default_value)
+        : Setting<int>(name, friendly_name, default_value), choices(choices)
+    {
+    }
+
+    const QStringList choices;
+};
@@ -4,6 +4,8 @@
 
 #include "Settings.h"
 
+#include <QCheckBox>
+#include <QComboBox>
 #include <QDoubleSpinBox>
 #include <QGridLayout>
 #include <QLabel>
@@ -65,6 +67,53 @@ SettingsDialog::SettingsDialog(QWidget* parent) : QDialog(parent)
         grid->addWidget(reset_button, row, 2);
         row++;
     }
+
+    for (Setting<bool>* const setting : Settings::BOOL_SETTINGS)
+    {
+        QLabel* label = new QLabel(setting->friendly_name, this);
+
+        QCheckBox* input = new QCheckBox(this);
+        input->setChecked(setting->Get());
+        connect(input, &QCheckBox::toggled, [setting](bool new_value) {
+            setting->Set(new_value);
+        });
+
+        QPushButton* reset_button = new QPushButton(QStringLiteral("Reset"), this);
+        connect(reset_button, &QAbstractButton::clicked, [setting, input] {
+            setting->Reset();
+            input->setChecked(setting->Get());
+        });
+        reset_button->setAutoDefault(false);
+
+        grid->addWidget(label, row, 0);
+        grid->addWidget(input, row, 1);
+        grid->addWidget(reset_button, row, 2);
+        row++;
+    }
+
+    for (ChoiceSetting* const setting : Settings::CHOICE_SETTINGS)
+    {
+        QLabel* label = new QLabel(setting->friendly_name, this);
+
+        QComboBox* input = new QComboBox(this);
+        input->addItems(setting->choices);
+        input->setCurrentIndex(setting->Get());
+        connect(input, QOverload<int>::of(&QComboBox::currentIndexChanged), [setting](int new_value) {
+            setting->Set(new_value);
+        });
+
+        QPushButton* reset_button = new QPushButton(QStringLiteral("Reset"), this);
+        connect(reset_button, &QAbstractButton::clicked, [setting, input] {
+            setting->Reset();
+            input->setCurrentIndex(setting->Get());
+        });
+        reset_button->setAutoDefault(false);
+
+        grid->addWidget(label, row, 0);
+        grid->addWidget(input, row, 1);
+        grid->addWidget(reset_button, row, 2);
+        row++;
+    }
 }
 
 SettingsDialog::~SettingsDialog() = default;
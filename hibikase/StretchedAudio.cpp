@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "StretchedAudio.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+// How many input frames each thread stretches at a time (about 24 seconds)
+static constexpr qint64 SEGMENT_FRAMES = 1048576;
+// How much extra input each segment gets on both sides, so that the stretcher
+// has settled down by the time it reaches the part of the output that is kept
+static constexpr qint64 SEGMENT_OVERLAP_FRAMES = 32768;
+// How many output frames the crossfade between two segments lasts
+static constexpr qint64 SEGMENT_CROSSFADE_FRAMES = 1024;
+// How many frames to pass to the stretcher at a time
+static constexpr qint64 PROCESS_CHUNK_FRAMES = 16384;
+// How many input frames apart the key frames are. The stretcher is free to stretch
+// some parts more than others in between, but the key frames end up exactly where a
+// uniform stretch would put them, as do the segment boundaries
+static constexpr qint64 KEY_FRAME_INTERVAL = 16384;
+
+static double GetPitchScale(int input_sample_rate, int output_sample_rate)
+{
+    return static_cast<double>(input_sample_rate) / output_sample_rate;
+}
+
+StretchedAudio::StretchedAudio(const AudioFile& audio_file, double time_ratio, int output_sample_rate,
+                               RubberBand::RubberBandStretcher::Options quality_options, FinishedCallback on_finished)
+    : m_input(audio_file.GetChannels()), m_input_frame_count(audio_file.GetFrameCount()),
+      m_sample_rate(audio_file.GetPCMFormat().sampleRate()), m_time_ratio(time_ratio),
+      m_pitch_scale(GetPitchScale(m_sample_rate, output_sample_rate)),
+      m_output_ratio(time_ratio / m_pitch_scale), m_quality_options(quality_options),
+      m_frame_count(std::llround(m_input_frame_count * m_output_ratio)),
+      m_on_finished(std::move(on_finished)), m_channel_count(m_input.size())
+{
+    // The segments are allocated by the threads that render them, so that a slow
+    // allocation doesn't hold up the thread that asked for the stretched audio
+    const qint64 segment_count = (m_input_frame_count + SEGMENT_FRAMES - 1) / SEGMENT_FRAMES;
+    for (qint64 segment = 0; segment < segment_count; ++segment)
+        m_segment_starts.push_back(StretchedFrame(segment * SEGMENT_FRAMES));
+    m_segment_starts.push_back(m_frame_count);
+    m_segments.resize(segment_count);
+
+    m_thread = std::thread(&StretchedAudio::Render, this);
+}
+
+StretchedAudio::~StretchedAudio()
+{
+    m_cancel = true;
+    m_thread.join();
+}
+
+qint64 StretchedAudio::GetByteCount(const AudioFile& audio_file, double time_ratio, int output_sample_rate)
+{
+    const double output_ratio =
+            time_ratio / GetPitchScale(audio_file.GetPCMFormat().sampleRate(), output_sample_rate);
+    const qint64 frames = std::llround(audio_file.GetFrameCount() * output_ratio);
+    return frames * static_cast<qint64>(audio_file.GetChannels().size() * sizeof(float));
+}
+
+qint64 StretchedAudio::GetByteCount() const
+{
+    return m_frame_count * static_cast<qint64>(m_channel_count * sizeof(float));
+}
+
+size_t StretchedAudio::GetFrames(qint64 position, size_t max_frames, const float** channels_out) const
+{
+    if (position < 0 || position >= m_frame_count)
+        return 0;
+
+    const qint64 segment = std::upper_bound(m_segment_starts.begin(), m_segment_starts.end(), position) -
+                           m_segment_starts.begin() - 1;
+    const qint64 offset = position - m_segment_starts[segment];
+    for (size_t i = 0; i < m_channel_count; ++i)
+        channels_out[i] = GetSegmentChannel(segment, i) + offset;
+
+    return std::min<size_t>(m_segment_starts[segment + 1] - position, max_frames);
+}
+
+qint64 StretchedAudio::StretchedFrame(qint64 input_frame) const
+{
+    return std::llround(input_frame * m_output_ratio);
+}
+
+float* StretchedAudio::GetSegmentChannel(qint64 segment, size_t channel) const
+{
+    return m_segments[segment].get() + channel * GetSegmentLength(segment);
+}
+
+qint64 StretchedAudio::GetSegmentLength(qint64 segment) const
+{
+    return m_segment_starts[segment + 1] - m_segment_starts[segment];
+}
+
+void StretchedAudio::Render()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const qint64 segment_count = (m_input_frame_count + SEGMENT_FRAMES - 1) / SEGMENT_FRAMES;
+    // Leave a core for the rest of the program, since playback goes on while this runs
+    const int thread_count = static_cast<int>(std::min<qint64>(
+            std::max(static_cast<int>(std::thread::hardware_concurrency()) - 1, 1), segment_count));
+
+    // The output of each segment (except the last) continues a little past where the
+    // next segment starts, so that the two can be crossfaded once both are done
+    std::vector<std::vector<std::vector<float>>> tails(segment_count);
+
+    std::atomic<qint64> next_segment{0};
+    const auto render_segments = [&] {
+        for (qint64 segment = next_segment++; segment < segment_count && !m_cancel; segment = next_segment++)
+            RenderSegment(segment, &tails[segment]);
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < thread_count; ++i)
+        threads.emplace_back(render_segments);
+    render_segments();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    if (m_cancel)
+    {
+        qInfo() << "Cancelled rendering audio at time ratio" << m_time_ratio;
+        m_running.store(false, std::memory_order_release);
+        if (m_on_finished)
+            m_on_finished();
+        return;
+    }
+
+    // Each tail overlaps the start of the next segment
+    for (qint64 segment = 0; segment + 1 < segment_count; ++segment)
+    {
+        const std::vector<std::vector<float>>& tail = tails[segment];
+        for (size_t i = 0; i < m_channel_count; ++i)
+        {
+            float* out = GetSegmentChannel(segment + 1, i);
+            const qint64 frames = std::min<qint64>(tail[i].size(), GetSegmentLength(segment + 1));
+            for (qint64 j = 0; j < frames; ++j)
+            {
+                const float gain = float(j + 1) / (SEGMENT_CROSSFADE_FRAMES + 1);
+                out[j] = out[j] * gain + tail[i][j] * (1.0f - gain);
+            }
+        }
+    }
+
+    qInfo() << "Rendered audio at time ratio" << m_time_ratio << "in" << timer.elapsed() << "ms using"
+            << thread_count << "thread(s)";
+
+    m_finished.store(true, std::memory_order_release);
+    m_running.store(false, std::memory_order_release);
+    if (m_on_finished)
+        m_on_finished();
+}
+
+void StretchedAudio::RenderSegment(qint64 segment, std::vector<std::vector<float>>* tail)
+{
+    const size_t channel_count = m_channel_count;
+    const bool last_segment = (segment + 1) * SEGMENT_FRAMES >= m_input_frame_count;
+
+    const qint64 start = segment * SEGMENT_FRAMES;
+    const qint64 end = std::min(start + SEGMENT_FRAMES, m_input_frame_count);
+    const qint64 input_start = std::max<qint64>(start - SEGMENT_OVERLAP_FRAMES, 0);
+    const qint64 input_end = std::min(end + SEGMENT_OVERLAP_FRAMES, m_input_frame_count);
+
+    // Which output frames this segment is responsible for, in the coordinates of the whole output
+    const qint64 output_base = StretchedFrame(input_start);
+    const qint64 output_start = StretchedFrame(start);
+    const qint64 output_end = StretchedFrame(end);
+    const qint64 tail_end = last_segment ? output_end :
+                            std::min(output_end + SEGMENT_CROSSFADE_FRAMES, m_frame_count);
+
+    tail->assign(channel_count, std::vector<float>());
+
+    // Not zeroed, since every frame gets written below
+    const qint64 segment_length = GetSegmentLength(segment);
+    m_segments[segment].reset(new float[static_cast<size_t>(segment_length * channel_count)]);
+    std::vector<float*> segment_channels(channel_count);
+    for (size_t i = 0; i < channel_count; ++i)
+        segment_channels[i] = GetSegmentChannel(segment, i);
+
+    // Offline mode automatically compensates for the latency of the stretcher,
+    // so the output lines up with the input
+    RubberBand::RubberBandStretcher stretcher(
+            m_sample_rate, static_cast<int>(channel_count),
+            RubberBand::RubberBandStretcher::Option::OptionProcessOffline |
+            RubberBand::RubberBandStretcher::Option::OptionThreadingNever |
+            RubberBand::RubberBandStretcher::Option::OptionPitchHighQuality | m_quality_options,
+            m_output_ratio, m_pitch_scale);
+    stretcher.setExpectedInputDuration(static_cast<size_t>(input_end - input_start));
+    stretcher.setMaxProcessSize(PROCESS_CHUNK_FRAMES);
+
+    std::vector<const float*> input_pointers(channel_count);
+    const auto set_input_pointers = [&](qint64 position) {
+        for (size_t i = 0; i < channel_count; ++i)
+            input_pointers[i] = m_input[i] + position;
+    };
+
+    for (qint64 position = input_start; position < input_end && !m_cancel; position += PROCESS_CHUNK_FRAMES)
+    {
+        const qint64 frames = std::min(PROCESS_CHUNK_FRAMES, input_end - position);
+        set_input_pointers(position);
+        stretcher.study(input_pointers.data(), static_cast<size_t>(frames), position + frames == input_end);
+    }
+
+    // Offline RubberBand spreads the stretching unevenly, depending on where the transients are.
+    // Without key frames, the segment boundaries, and everything that converts frames with
+    // StretchedFrame, would be off by however much the stretching has drifted by then
+    std::map<size_t, size_t> key_frames;
+    const auto add_key_frame = [&](qint64 position) {
+        key_frames[static_cast<size_t>(position - input_start)] =
+                static_cast<size_t>(StretchedFrame(position) - output_base);
+    };
+    for (qint64 position = input_start; position < input_end; position += KEY_FRAME_INTERVAL)
+        add_key_frame(position);
+    add_key_frame(start);
+    add_key_frame(end);
+    add_key_frame(input_end);
+    stretcher.setKeyFrameMap(key_frames);
+
+    std::vector<std::vector<float>> chunk(channel_count, std::vector<float>(PROCESS_CHUNK_FRAMES));
+    std::vector<float*> chunk_pointers(channel_count);
+    for (size_t i = 0; i < channel_count; ++i)
+        chunk_pointers[i] = chunk[i].data();
+
+    qint64 output_position = output_base;
+    const auto retrieve_available = [&] {
+        int available;
+        while ((available = stretcher.available()) > 0 && !m_cancel)
+        {
+            const size_t frames = stretcher.retrieve(
+                    chunk_pointers.data(), std::min<size_t>(available, PROCESS_CHUNK_FRAMES));
+            if (frames == 0)
+                break;
+
+            // Keep the frames that belong to this segment, and the ones for the crossfade after it
+            for (size_t j = 0; j < frames; ++j, ++output_position)
+            {
+                if (output_position >= output_start && output_position < output_end)
+                {
+                    for (size_t i = 0; i < channel_count; ++i)
+                        segment_channels[i][output_position - output_start] = chunk[i][j];
+                }
+                else if (output_position >= output_end && output_position < tail_end)
+                {
+                    for (size_t i = 0; i < channel_count; ++i)
+                        (*tail)[i].push_back(chunk[i][j]);
+                }
+            }
+        }
+    };
+
+    for (qint64 position = input_start; position < input_end && !m_cancel; position += PROCESS_CHUNK_FRAMES)
+    {
+        const qint64 frames = std::min(PROCESS_CHUNK_FRAMES, input_end - position);
+        set_input_pointers(position);
+        stretcher.process(input_pointers.data(), static_cast<size_t>(frames), position + frames == input_end);
+        retrieve_available();
+    }
+    retrieve_available();
+
+    // In case the stretcher came up a little short, don't leave garbage behind
+    for (; output_position < output_end; ++output_position)
+    {
+        if (output_position >= output_start)
+        {
+            for (size_t i = 0; i < channel_count; ++i)
+                segment_channels[i][output_position - output_start] = 0.0f;
+        }
+    }
+}
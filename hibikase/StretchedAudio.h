@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <QtGlobal>
+
+#include <RubberBandStretcher.h>
+
+#include "AudioFile.h"
+
+// A copy of a fully decoded AudioFile, time-stretched ahead of time by RubberBand
+// in offline mode. That sounds better than the real-time mode and costs nothing
+// during playback, but takes a while, so the rendering is spread across all CPU
+// cores on background threads.
+//
+// The file is stretched in segments, and each segment gets its own allocation,
+// which is made by the thread that renders it. A key frame map pins the stretched
+// audio to the same positions that a uniform stretch would put it at, so that
+// frames can be converted between the two with a multiplication.
+class StretchedAudio final
+{
+public:
+    // Called on a background thread once rendering has finished or has been cancelled
+    using FinishedCallback = std::function<void()>;
+
+    // The AudioFile must have finished decoding, must not be in low-memory mode,
+    // and must outlive the StretchedAudio. The stretched audio is resampled to output_sample_rate
+    // in the same pass. quality_options are passed on to RubberBand
+    StretchedAudio(const AudioFile& audio_file, double time_ratio, int output_sample_rate,
+                   RubberBand::RubberBandStretcher::Options quality_options, FinishedCallback on_finished);
+    // Waits for the rendering threads, so unless rendering is finished, call Cancel
+    // and wait for the callback first
+    ~StretchedAudio();
+
+    // How much memory the stretched audio would take up
+    static qint64 GetByteCount(const AudioFile& audio_file, double time_ratio, int output_sample_rate);
+
+    StretchedAudio(const StretchedAudio&) = delete;
+    StretchedAudio& operator=(const StretchedAudio&) = delete;
+
+    double GetTimeRatio() const { return m_time_ratio; }
+    RubberBand::RubberBandStretcher::Options GetQualityOptions() const { return m_quality_options; }
+    qint64 GetByteCount() const;
+    bool IsFinished() const
+    {
+        return m_finished.load(std::memory_order_acquire);
+    }
+    // Makes the rendering threads stop soon. Doesn't wait for them
+    void Cancel() { m_cancel = true; }
+    // False once the rendering threads are done, whether they finished or were cancelled
+    bool IsRunning() const
+    {
+        return m_running.load(std::memory_order_acquire);
+    }
+
+    // The functions below may only be used once IsFinished returns true
+
+    qint64 GetFrameCount() const { return m_frame_count; }
+    // Works like AudioFile::GetFrames. Stops at the end of a segment, so it can return fewer
+    // frames than requested even when there are more after them
+    size_t GetFrames(qint64 position, size_t max_frames, const float** channels_out) const;
+    // The frame of the stretched audio that corresponds to a frame of the original audio
+    qint64 StretchedFrame(qint64 input_frame) const;
+
+private:
+    void Render();
+    void RenderSegment(qint64 segment, std::vector<std::vector<float>>* tail);
+    float* GetSegmentChannel(qint64 segment, size_t channel) const;
+    qint64 GetSegmentLength(qint64 segment) const;
+
+    const std::vector<const float*>& m_input;
+    const qint64 m_input_frame_count;
+    const int m_sample_rate;
+    const double m_time_ratio;
+    // Changes the sample rate without changing the pitch, together with m_output_ratio
+    const double m_pitch_scale;
+    // How many output frames each input frame turns into
+    const double m_output_ratio;
+    const RubberBand::RubberBandStretcher::Options m_quality_options;
+    const qint64 m_frame_count;
+    FinishedCallback m_on_finished;
+
+    const size_t m_channel_count;
+
+    // The output frame that each segment starts at, plus m_frame_count at the end
+    std::vector<qint64> m_segment_starts;
+    // The channels of each segment share one allocation, one channel after the other
+    std::vector<std::unique_ptr<float[]>> m_segments;
+
+    std::thread m_thread;
+    std::atomic<bool> m_cancel{false};
+    std::atomic<bool> m_finished{false};
+    std::atomic<bool> m_running{true};
+};
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "WaveformPeaks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// How many frames each bucket of the finest level covers
+static constexpr qint64 BASE_BUCKET_FRAMES = 256;
+// How many buckets of a level are combined into one bucket of the level above
+static constexpr qint64 LEVEL_FACTOR = 4;
+
+static constexpr WaveformPeaks::Peak SILENCE{0.0f, 0.0f, 0.0f};
+
+WaveformPeaks::WaveformPeaks(qint64 frame_count)
+    : m_frame_count(frame_count)
+{
+    // Keep adding levels until one bucket covers everything
+    qint64 bucket_frames = BASE_BUCKET_FRAMES;
+    while (true)
+    {
+        Level level;
+        level.bucket_frames = bucket_frames;
+        level.buckets.resize(static_cast<size_t>((frame_count + bucket_frames - 1) / bucket_frames));
+        m_levels.push_back(std::move(level));
+
+        if (bucket_frames >= frame_count)
+            break;
+        bucket_frames *= LEVEL_FACTOR;
+    }
+}
+
+qint64 WaveformPeaks::BucketFrames(const Level& level, qint64 index) const
+{
+    return std::min(level.bucket_frames, m_frame_count - index * level.bucket_frames);
+}
+
+void WaveformPeaks::AddFrames(const std::vector<const float*>& channels, qint64 start, qint64 end)
+{
+    Level& level = m_levels.front();
+    const float channel_weight = 1.0f / channels.size();
+
+    qint64 position = start;
+    while (position < end)
+    {
+        const qint64 index = position / BASE_BUCKET_FRAMES;
+        const qint64 bucket_end = std::min((index + 1) * BASE_BUCKET_FRAMES, end);
+
+        // If the previous range ended in the middle of this bucket, continue where it left off
+        Bucket bucket = position % BASE_BUCKET_FRAMES == 0 ?
+                        Bucket{std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0.0f} :
+                        level.buckets[index];
+        float sum_squares = bucket.mean_square * (position - index * BASE_BUCKET_FRAMES);
+
+        for (qint64 i = position; i < bucket_end; ++i)
+        {
+            float sample = 0.0f;
+            for (const float* channel : channels)
+                sample += channel[i];
+            sample *= channel_weight;
+
+            bucket.min = std::min(bucket.min, sample);
+            bucket.max = std::max(bucket.max, sample);
+            sum_squares += sample * sample;
+        }
+
+        bucket.mean_square = sum_squares / (bucket_end - index * BASE_BUCKET_FRAMES);
+        level.buckets[index] = bucket;
+        position = bucket_end;
+    }
+}
+
+void WaveformPeaks::SetReadyFrames(qint64 ready_frames, bool finished)
+{
+    // If decoding stopped early, the last bucket is cut short
+    const qint64 frame_count = finished ? std::min(m_frame_count, ready_frames) : m_frame_count;
+
+    // A partially filled bucket may only be used at the end of the audio
+    m_levels.front().computed_buckets = ready_frames >= frame_count ?
+            (frame_count + BASE_BUCKET_FRAMES - 1) / BASE_BUCKET_FRAMES :
+            ready_frames / BASE_BUCKET_FRAMES;
+
+    for (size_t i = 1; i < m_levels.size(); ++i)
+    {
+        const Level& child_level = m_levels[i - 1];
+        Level& level = m_levels[i];
+
+        // A bucket can only be computed once all of its children have been.
+        // The last bucket of the audio usually has fewer children than the others.
+        qint64 computable = child_level.computed_buckets / LEVEL_FACTOR;
+        if (child_level.computed_buckets * child_level.bucket_frames >= frame_count)
+            computable = (child_level.computed_buckets + LEVEL_FACTOR - 1) / LEVEL_FACTOR;
+        computable = std::min<qint64>(computable, level.buckets.size());
+
+        for (qint64 index = level.computed_buckets; index < computable; ++index)
+        {
+            Bucket bucket{std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0.0f};
+            float sum_squares = 0.0f;
+            qint64 frames = 0;
+
+            const qint64 first_child = index * LEVEL_FACTOR;
+            const qint64 last_child = std::min<qint64>(first_child + LEVEL_FACTOR, child_level.computed_buckets);
+            for (qint64 child = first_child; child < last_child; ++child)
+            {
+                const Bucket& child_bucket = child_level.buckets[child];
+                const qint64 child_frames = BucketFrames(child_level, child);
+                bucket.min = std::min(bucket.min, child_bucket.min);
+                bucket.max = std::max(bucket.max, child_bucket.max);
+                sum_squares += child_bucket.mean_square * child_frames;
+                frames += child_frames;
+            }
+
+            bucket.mean_square = frames > 0 ? sum_squares / frames : 0.0f;
+            level.buckets[index] = bucket;
+        }
+
+        level.computed_buckets = std::max(level.computed_buckets, computable);
+    }
+
+    m_ready_frames.store(ready_frames, std::memory_order_release);
+    if (finished)
+        m_finished.store(true, std::memory_order_release);
+}
+
+void WaveformPeaks::GetPeaks(qint64 start, qint64 end, int pixels, Peak* out) const
+{
+    if (pixels <= 0)
+        return;
+
+    // Once finished is set, ready_frames is guaranteed to have its final value
+    const bool finished = m_finished.load(std::memory_order_acquire);
+    const qint64 ready_frames = GetReadyFrames();
+    const double frames_per_pixel = double(end - start) / pixels;
+
+    // Use the coarsest level whose buckets still are no wider than a pixel,
+    // so that each pixel only needs to combine a few buckets
+    size_t level_index = 0;
+    while (level_index + 1 < m_levels.size() && m_levels[level_index + 1].bucket_frames <= frames_per_pixel)
+        ++level_index;
+    const Level& level = m_levels[level_index];
+
+    for (int pixel = 0; pixel < pixels; ++pixel)
+    {
+        const qint64 pixel_start = start + static_cast<qint64>(pixel * frames_per_pixel);
+        const qint64 pixel_end = std::max(start + static_cast<qint64>((pixel + 1) * frames_per_pixel),
+                                          pixel_start + 1);
+
+        // Only buckets that are fully ready can be used, except at the very end of the audio
+        const qint64 first_bucket = std::max<qint64>(pixel_start, 0) / level.bucket_frames;
+        qint64 last_bucket = (std::min(pixel_end, ready_frames) + level.bucket_frames - 1) / level.bucket_frames;
+        if (!finished && ready_frames < m_frame_count)
+            last_bucket = std::min(last_bucket, ready_frames / level.bucket_frames);
+
+        if (first_bucket >= last_bucket)
+        {
+            out[pixel] = SILENCE;
+            continue;
+        }
+
+        Bucket bucket{std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), 0.0f};
+        float sum_squares = 0.0f;
+        qint64 frames = 0;
+        for (qint64 i = first_bucket; i < last_bucket; ++i)
+        {
+            const Bucket& b = level.buckets[i];
+            const qint64 bucket_frames = BucketFrames(level, i);
+            bucket.min = std::min(bucket.min, b.min);
+            bucket.max = std::max(bucket.max, b.max);
+            sum_squares += b.mean_square * bucket_frames;
+            frames += bucket_frames;
+        }
+
+        out[pixel] = Peak{bucket.min, bucket.max, std::sqrt(sum_squares / frames)};
+    }
+}
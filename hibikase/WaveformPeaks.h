@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include <QtGlobal>
+
+// A mipmap pyramid of the minimum, maximum and RMS of the audio, mixed down
+// to one channel. The finest level has one bucket per 256 frames, and each
+// level above it has four times fewer buckets, so drawing any range of the
+// audio at any width only costs a few bucket lookups per pixel.
+class WaveformPeaks final
+{
+public:
+    struct Peak
+    {
+        float min;
+        float max;
+        float rms;
+    };
+
+    explicit WaveformPeaks(qint64 frame_count);
+
+    WaveformPeaks(const WaveformPeaks&) = delete;
+    WaveformPeaks& operator=(const WaveformPeaks&) = delete;
+
+    qint64 GetFrameCount() const { return m_frame_count; }
+    // Peaks are available for the frames before this. Never decreases
+    qint64 GetReadyFrames() const
+    {
+        return m_ready_frames.load(std::memory_order_acquire);
+    }
+
+    // Computes the finest level for the given frames. May be called from several threads
+    // at once for different ranges. start must be a multiple of 256 (or the end of a range
+    // that already has been added), and the ranges must not overlap.
+    void AddFrames(const std::vector<const float*>& channels, qint64 start, qint64 end);
+    // Computes the coarser levels for all frames before ready_frames, which must all have been
+    // passed to AddFrames, and makes them available to readers. Calls must not happen in parallel.
+    // When finished is true, the audio is considered to end at ready_frames.
+    void SetReadyFrames(qint64 ready_frames, bool finished = false);
+
+    // Writes one peak per pixel to out, covering the frames [start, end).
+    // Pixels that cover frames which aren't ready yet are left as silence.
+    void GetPeaks(qint64 start, qint64 end, int pixels, Peak* out) const;
+
+private:
+    struct Bucket
+    {
+        float min;
+        float max;
+        float mean_square;
+    };
+
+    struct Level
+    {
+        qint64 bucket_frames;
+        std::vector<Bucket> buckets;
+        // The buckets before this have been computed
+        qint64 computed_buckets = 0;
+    };
+
+    qint64 BucketFrames(const Level& level, qint64 index) const;
+
+    qint64 m_frame_count;
+    std::vector<Level> m_levels;
+    std::atomic<qint64> m_ready_frames{0};
+    std::atomic<bool> m_finished{false};
+};
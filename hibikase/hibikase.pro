@@ -39,42 +39,74 @@ RESOURCES += ../resources/resources.qrc
 
 SOURCES += main.cpp \
     AboutDialog.cpp \
+    AudioCache.cpp \
+    AudioDecoder.cpp \
+    AudioDiagnosticsDialog.cpp \
     AudioFile.cpp \
+    AudioOutputDevice.cpp \
     AudioOutputWorker.cpp \
+    AudioRenderer.cpp \
+    AudioSink.cpp \
+    AudioStats.cpp \
+    Benchmark.cpp \
     MainWindow.cpp \
+    Interleave.cpp \
     KaraokeData/Song.cpp \
     KaraokeData/SoramimiSong.cpp \
     KaraokeContainer/Container.cpp \
+    KaraokeContainer/MappedFile.cpp \
     KaraokeContainer/PlainContainer.cpp \
     KaraokeData/VsqxParser.cpp \
     LyricsEditor.cpp \
     PlaybackBarWidget.cpp \
+    PlaybackClock.cpp \
     PlaybackWidget.cpp \
+    RealTimeStretcher.cpp \
+    Resampler.cpp \
     Settings.cpp \
     SettingsDialog.cpp \
+    StretchedAudio.cpp \
     TextTransform/Syllabify.cpp \
     TextTransform/RomanizeHangul.cpp \
     TextTransform/HangulUtils.cpp \
+    WaveformPeaks.cpp \
     LineTimingDecorations.cpp
 
 HEADERS  += MainWindow.h \
     AboutDialog.h \
+    AudioCache.h \
+    AudioDecoder.h \
+    AudioDiagnosticsDialog.h \
     AudioFile.h \
+    AudioOutputDevice.h \
     AudioOutputWorker.h \
+    AudioRenderer.h \
+    AudioSink.h \
+    AudioStats.h \
+    Benchmark.h \
+    Interleave.h \
+    KaraokeData/FenwickTree.h \
     KaraokeData/Song.h \
     KaraokeData/SoramimiSong.h \
     KaraokeContainer/Container.h \
+    KaraokeContainer/MappedFile.h \
     KaraokeContainer/PlainContainer.h \
     KaraokeData/ReadOnlySong.h \
     KaraokeData/VsqxParser.h \
     LyricsEditor.h \
     PlaybackBarWidget.h \
+    PlaybackClock.h \
     PlaybackWidget.h \
+    RealTimeStretcher.h \
+    Resampler.h \
+    RingBuffer.h \
     Settings.h \
     SettingsDialog.h \
+    StretchedAudio.h \
     TextTransform/Syllabify.h \
     TextTransform/RomanizeHangul.h \
     TextTransform/HangulUtils.h \
+    WaveformPeaks.h \
     LineTimingDecorations.h
 
 FORMS    += MainWindow.ui
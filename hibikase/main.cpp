@@ -1,11 +1,21 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 
+#include <cstring>
+
 #include <QApplication>
+#include <QCoreApplication>
 
+#include "Benchmark.h"
 #include "MainWindow.h"
 
 int main(int argc, char* argv[])
 {
+    if (argc >= 2 && std::strcmp(argv[1], "--benchmark") == 0)
+    {
+        QCoreApplication a(argc, argv);
+        return Benchmark::Run(a.arguments().mid(2));
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.showMaximized();